@@ -0,0 +1,41 @@
+/*
+ * alloc.c - Memory allocator used for all buffers of decoder and writer
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+
+#include "alloc.h"
+
+void *mem_malloc(const mem_alloc_t *alloc, size_t size)
+{
+	return mem_realloc(alloc, NULL, size);
+}
+
+void *mem_realloc(const mem_alloc_t *alloc, void *ptr, size_t size)
+{
+	/* Zero sized buffer is still a valid one */
+	if (size == 0)
+		size = 1;
+
+	if (alloc == NULL)
+		return realloc(ptr, size);
+
+	return alloc->realloc(alloc->opaque, ptr, size);
+}
+
+void mem_free(const mem_alloc_t *alloc, void *ptr)
+{
+	if (ptr == NULL)
+		return;
+
+	if (alloc == NULL)
+		free(ptr);
+	else
+		alloc->realloc(alloc->opaque, ptr, 0);
+}
@@ -0,0 +1,32 @@
+/*
+ * alloc.h - Memory allocator used for all buffers of decoder and writer
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+
+/* Caller supplied allocator - one function covers it all, as realloc():
+   ptr NULL allocates, size 0 frees (return value is ignored then).
+   Must be thread safe if it is shared by contexts used from more threads */
+typedef void *(*mem_realloc_fn)(void *opaque, void *ptr, size_t size);
+
+typedef struct
+{
+	mem_realloc_fn realloc;
+	void *opaque;		/* Passed to realloc */
+} mem_alloc_t;
+
+/* All of them use malloc()/realloc()/free() if alloc is NULL */
+extern void *mem_malloc(const mem_alloc_t *alloc, size_t size);
+extern void *mem_realloc(const mem_alloc_t *alloc, void *ptr, size_t size);
+extern void mem_free(const mem_alloc_t *alloc, void *ptr);
+
+#endif // ALLOC_H
@@ -0,0 +1,176 @@
+/*
+ * arena.c - Arena of buffers of one image, reset between images
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+#define ALIGN_UP(size, align)	(((size) + (align) - 1) & ~((size_t) (align) - 1))
+
+/* Allocation which has not fit into block */
+struct arena_chunk
+{
+	struct arena_chunk *next;
+};
+
+#define SIZE_CHUNK	ALIGN_UP(sizeof(struct arena_chunk), ARENA_ALIGN)
+/* Size stored in front of allocations made through arena->alloc */
+#define SIZE_PREFIX	ARENA_ALIGN
+
+/* Large blocks are mapped at hugepage boundary and hinted as hugepages */
+static uint8_t *block_map(size_t size)
+{
+#ifdef MADV_HUGEPAGE
+	uint8_t *map;
+	uint8_t *base;
+	size_t head;
+
+	map = (uint8_t *) mmap(NULL, size + ARENA_HUGE_MIN,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	/* Unmap whatever is out of aligned block */
+	base = (uint8_t *) ALIGN_UP((uintptr_t) map, ARENA_HUGE_MIN);
+	head = base - map;
+	if (head)
+		munmap(map, head);
+	munmap(base + size, ARENA_HUGE_MIN - head);
+
+	madvise(base, size, MADV_HUGEPAGE);
+
+	return base;
+#else
+	return NULL;
+#endif
+}
+
+static void block_free(arena_t *arena)
+{
+	if (arena->mapped)
+		munmap(arena->base, arena->size);
+	else
+		free(arena->base);
+
+	arena->base = NULL;
+	arena->size = 0;
+	arena->mapped = 0;
+}
+
+static int block_alloc(arena_t *arena, size_t size)
+{
+	if (arena->huge && size >= ARENA_HUGE_MIN) {
+		size = ALIGN_UP(size, ARENA_HUGE_MIN);
+		if ((arena->base = block_map(size)) != NULL) {
+			arena->size = size;
+			arena->mapped = 1;
+			return 0;
+		}
+	}
+
+	if ((arena->base = (uint8_t *) malloc(size)) == NULL)
+		return 1;
+	arena->size = size;
+
+	return 0;
+}
+
+/* mem_realloc_fn of arena - size of allocation is kept in front of it */
+static void *arena_realloc(void *opaque, void *ptr, size_t size)
+{
+	arena_t *arena = (arena_t *) opaque;
+	uint8_t *prefix = (ptr) ? (uint8_t *) ptr - SIZE_PREFIX : NULL;
+	size_t old = (ptr) ? *(size_t *) prefix : 0;
+	size_t len = ALIGN_UP(SIZE_PREFIX + old, ARENA_ALIGN);
+	uint8_t *data;
+
+	/* Freed block is reused only if it was the last one taken */
+	if (size == 0) {
+		if (prefix + len == arena->base + arena->used) {
+			arena->used -= len;
+			arena->high -= len;
+		}
+		return NULL;
+	}
+
+	if ((data = (uint8_t *) arena_alloc(arena, SIZE_PREFIX + size))
+		== NULL)
+		return NULL;
+	*(size_t *) data = size;
+	data += SIZE_PREFIX;
+	if (ptr)
+		memcpy(data, ptr, (old < size) ? old : size);
+
+	return data;
+}
+
+void arena_init(arena_t *arena, int huge)
+{
+	memset(arena, 0, sizeof(arena_t));
+	arena->huge = huge;
+	arena->alloc.realloc = arena_realloc;
+	arena->alloc.opaque = arena;
+}
+
+void arena_destroy(arena_t *arena)
+{
+	arena_reset(arena, 0);
+	block_free(arena);
+}
+
+int arena_reset(arena_t *arena, size_t size)
+{
+	struct arena_chunk *chunk;
+
+	while ((chunk = arena->chunks) != NULL) {
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+
+	/* Block grows to hold everything previous image needed */
+	if (size < arena->high)
+		size = arena->high;
+	size = ALIGN_UP(size, ARENA_ALIGN);
+	arena->used = 0;
+	arena->high = 0;
+
+	if (size <= arena->size)
+		return 0;
+
+	block_free(arena);
+
+	return block_alloc(arena, size);
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+	struct arena_chunk *chunk;
+	void *data;
+
+	size = ALIGN_UP((size) ? size : 1, ARENA_ALIGN);
+	arena->high += size;
+
+	if (arena->size - arena->used >= size) {
+		data = arena->base + arena->used;
+		arena->used += size;
+		return data;
+	}
+
+	if ((chunk = (struct arena_chunk *) malloc(SIZE_CHUNK + size)) == NULL)
+		return NULL;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+
+	return (uint8_t *) chunk + SIZE_CHUNK;
+}
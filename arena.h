@@ -0,0 +1,52 @@
+/*
+ * arena.h - Arena of buffers of one image, reset between images
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "alloc.h"
+
+#define ARENA_ALIGN	16u		/* Alignment of every allocation */
+#define ARENA_HUGE_MIN	(2u << 20)	/* Smallest hugepage backed block */
+
+struct arena_chunk;
+
+/* Allocations are taken from one block, one after another. Whatever does
+   not fit goes into separate chunks, and the block is grown to hold all of
+   it on the next reset - so the same work allocates nothing the next time */
+typedef struct arena
+{
+	uint8_t *base;		/* Block */
+	size_t size;
+	size_t used;
+	size_t high;		/* Bytes allocated since reset (incl. chunks) */
+	int huge;		/* Back large block by hugepages (if possible) */
+	int mapped;		/* Block is mapped, not malloc'd */
+	struct arena_chunk *chunks;	/* Allocations over block size */
+	mem_alloc_t alloc;	/* Arena as allocator - see arena_init() */
+} arena_t;
+
+/* Empty arena - nothing is allocated until arena_reset() or arena_alloc().
+   arena->alloc allocates from arena too (freeing the last allocation only
+   gives it back), so it can be passed wherever mem_alloc_t is taken */
+extern void arena_init(arena_t *arena, int huge);
+extern void arena_destroy(arena_t *arena);
+
+/* Release everything allocated from arena and make sure block holds at
+   least size bytes, returns non-zero if it could not be grown */
+extern int arena_reset(arena_t *arena, size_t size);
+
+/* NULL if out of memory */
+extern void *arena_alloc(arena_t *arena, size_t size);
+
+#endif // ARENA_H
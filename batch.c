@@ -0,0 +1,211 @@
+/*
+ * batch.c - Convert list of GIF images on a pool of worker threads
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "batch.h"
+#include "gif.h"
+#include "stats.h"
+
+/* State shared by all workers */
+typedef struct
+{
+	const batch_t *batch;
+	pthread_mutex_t lock;	/* Guards list reading, status and counters */
+	unsigned done;
+	unsigned failed;
+} pool_t;
+
+/* Per-worker buffers - reused for every file the worker converts */
+typedef struct
+{
+	pool_t *pool;
+	pthread_t thread;
+	gif_ctx_t *ctx;
+	arena_t arena;		/* Canvas and BMP row of current file */
+	image_t img;
+	char *s_input;
+	size_t input_size;
+	char *s_output;
+	size_t output_size;
+} worker_t;
+
+/* Read next input/output pair from list, 0 at the end of list */
+static int batch_next(worker_t *w)
+{
+	const batch_t *batch = w->pool->batch;
+	ssize_t len;
+	char *sep;
+
+	for (;;) {
+		len = getdelim(&w->s_input, &w->input_size, batch->delim,
+			batch->f_list);
+		if (len < 0)
+			return 0;
+		if (len > 0 && w->s_input[len - 1] == batch->delim)
+			w->s_input[--len] = '\0';
+		if (len == 0)
+			continue;	/* Skip empty entries */
+
+		/* NUL separated list - output is the next entry */
+		if (batch->delim == '\0') {
+			len = getdelim(&w->s_output, &w->output_size, '\0',
+				batch->f_list);
+			if (len <= 0) {
+				fprintf(stderr, "Batch: missing output for "
+					"'%s'\n", w->s_input);
+				w->pool->failed++;
+				return 0;
+			}
+			if (w->s_output[len - 1] == '\0')
+				len--;
+			w->s_output[len] = '\0';
+			return 1;
+		}
+
+		/* Line list - output follows input after TAB */
+		if ((sep = strchr(w->s_input, '\t')) == NULL) {
+			fprintf(stderr, "Batch: missing output for '%s'\n",
+				w->s_input);
+			w->pool->failed++;
+			continue;
+		}
+		*sep = '\0';
+		len = strlen(sep + 1) + 1;
+		if (w->output_size < (size_t) len) {
+			free(w->s_output);
+			w->output_size = 0;
+			if ((w->s_output = (char *) malloc(len)) == NULL)
+				return 0;
+			w->output_size = len;
+		}
+		memcpy(w->s_output, sep + 1, len);
+
+		return 1;
+	}
+}
+
+static int batch_convert(worker_t *w)
+{
+	FILE *f_input;
+	FILE *f_output;
+	const conv_opts_t *conv = &w->pool->batch->conv;
+	stats_t stats = { .frames = 0 };
+	int ret;
+
+	if ((f_input = fopen(w->s_input, "rb")) == NULL) {
+		fprintf(stderr, "Error: opening file '%s': %s\n",
+			w->s_input, strerror(errno));
+		return 1;
+	}
+
+	if ((f_output = fopen(w->s_output, "w+b")) == NULL) {
+		fprintf(stderr, "Error: opening file '%s': %s\n",
+			w->s_output, strerror(errno));
+		fclose(f_input);
+		return 1;
+	}
+
+	ret = gif2bmp(f_input, f_output, w->s_output, &w->img, w->ctx,
+		&w->arena, conv, (conv->stats) ? &stats : NULL);
+	if (conv->stats)
+		stats_print(stderr, w->s_input, w->s_output, &stats);
+
+	fclose(f_input);
+	if (fclose(f_output))
+		ret = 1;
+
+	/* Do not leave truncated images behind */
+	if (ret)
+		remove(w->s_output);
+
+	return ret;
+}
+
+static void *batch_worker(void *arg)
+{
+	worker_t *w = (worker_t *) arg;
+	pool_t *pool = w->pool;
+	int ret;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		ret = batch_next(w);
+		pthread_mutex_unlock(&pool->lock);
+		if (!ret)
+			break;
+
+		ret = batch_convert(w);
+
+		pthread_mutex_lock(&pool->lock);
+		printf("%s\t%s\t%s\n", (ret) ? "error" : "ok",
+			w->s_input, w->s_output);
+		fflush(stdout);
+		if (ret)
+			pool->failed++;
+		else
+			pool->done++;
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+int batch_run(const batch_t *batch)
+{
+	pool_t pool = { .batch = batch, .done = 0, .failed = 0 };
+	worker_t *workers;
+	unsigned started = 0;
+
+	if ((workers = (worker_t *) calloc(batch->jobs, sizeof(worker_t)))
+		== NULL) {
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+
+	for (unsigned i = 0; i < batch->jobs; i++) {
+		workers[i].pool = &pool;
+		arena_init(&workers[i].arena, batch->conv.huge);
+		if ((workers[i].ctx = gif_ctx_create(NULL)) == NULL) {
+			fprintf(stderr, "Not enough memory\n");
+			break;
+		}
+		if (pthread_create(&workers[i].thread, NULL, batch_worker,
+			&workers[i])) {
+			fprintf(stderr, "Batch: cannot start worker\n");
+			gif_ctx_destroy(workers[i].ctx);
+			break;
+		}
+		started++;
+	}
+
+	for (unsigned i = 0; i < started; i++) {
+		pthread_join(workers[i].thread, NULL);
+		gif_ctx_destroy(workers[i].ctx);
+		arena_destroy(&workers[i].arena);
+		free(workers[i].s_input);
+		free(workers[i].s_output);
+	}
+
+	pthread_mutex_destroy(&pool.lock);
+	free(workers);
+
+	fprintf(stderr, "Batch: %u converted, %u failed\n",
+		pool.done, pool.failed);
+
+	return (started == 0 || pool.failed) ? 1 : 0;
+}
@@ -0,0 +1,31 @@
+/*
+ * batch.h - Convert list of GIF images on a pool of worker threads
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+#include "gif2bmp.h"
+
+/* Batch configuration */
+typedef struct
+{
+	FILE *f_list;		/* List of input/output file pairs */
+	int delim;		/* '\n' - "input<TAB>output" lines,
+				   '\0' - input and output NUL separated */
+	unsigned jobs;		/* Number of worker threads */
+	conv_opts_t conv;	/* Options of every conversion */
+} batch_t;
+
+/* Returns 0 if all files have been converted */
+extern int batch_run(const batch_t *batch);
+
+#endif // BATCH_H
@@ -0,0 +1,98 @@
+/*
+ * bench.c - Shared helpers of benchmark programs
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "bench.h"
+
+double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint8_t *bench_read(const char *path, size_t *len)
+{
+	FILE *f;
+	uint8_t *buf = NULL;
+	long size;
+
+	if ((f = fopen(path, "rb")) == NULL) {
+		fprintf(stderr, "Error: opening file '%s': %s\n", path,
+			strerror(errno));
+		return NULL;
+	}
+
+	if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0
+		|| fseek(f, 0, SEEK_SET))
+		goto read_err;
+
+	if ((buf = (uint8_t *) malloc(size ? size : 1)) == NULL)
+		goto read_err;
+	if (fread(buf, 1, size, f) != (size_t) size) {
+		free(buf);
+		buf = NULL;
+		goto read_err;
+	}
+	*len = size;
+
+read_err:
+	if (buf == NULL)
+		fprintf(stderr, "Error: reading file '%s'\n", path);
+	fclose(f);
+
+	return buf;
+}
+
+uint64_t bench_pixels(const char *dir, const char *name)
+{
+	char path[4096];
+	char entry[256];
+	unsigned width, height, frames;
+	unsigned long long pixels;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/" BENCH_MANIFEST, dir);
+	if ((f = fopen(path, "r")) == NULL)
+		return 0;
+
+	while (fscanf(f, "%255s %u %u %u %llu", entry, &width, &height,
+		&frames, &pixels) == 5) {
+		if (strcmp(entry, name) == 0) {
+			fclose(f);
+			return pixels;
+		}
+	}
+	fclose(f);
+
+	return 0;
+}
+
+void bench_report(const char *stage, const char *name, const char *variant,
+	uint64_t bytes, uint64_t pixels, double sec, long maxrss_kb)
+{
+	if (sec <= 0)
+		sec = 1e-9;
+
+	printf("%s\t%s\t%s\t%llu\t%llu\t%.6f\t%.1f\t%.1f\t%ld\n", stage, name,
+		variant, (unsigned long long) bytes,
+		(unsigned long long) pixels, sec, bytes / sec / 1e6,
+		pixels / sec / 1e6, maxrss_kb);
+	fflush(stdout);
+}
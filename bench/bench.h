@@ -0,0 +1,40 @@
+/*
+ * bench.h - Shared helpers of benchmark programs
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Number of runs of every measurement - the fastest one is reported */
+#define BENCH_ROUNDS	5
+
+/* Corpus manifest written by gifgen, one line per file:
+   name<TAB>width<TAB>height<TAB>frames<TAB>pixels */
+#define BENCH_MANIFEST	"manifest.tsv"
+
+/* Number of pixels of all images of corpus file, 0 if it is unknown */
+extern uint64_t bench_pixels(const char *dir, const char *name);
+
+/* Monotonic wall clock in seconds */
+extern double bench_now(void);
+
+/* Load whole file into memory (malloc'd), NULL on error */
+extern uint8_t *bench_read(const char *path, size_t *len);
+
+/* Print result line - every benchmark program reports the same columns:
+   stage case variant bytes pixels sec MB/s Mpx/s maxrss_kb
+   maxrss_kb is 0 when not measured */
+extern void bench_report(const char *stage, const char *name,
+	const char *variant, uint64_t bytes, uint64_t pixels, double sec,
+	long maxrss_kb);
+
+#endif // BENCH_H
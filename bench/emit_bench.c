@@ -0,0 +1,256 @@
+/*
+ * emit_bench.c - Compare LZW string emission of the old (row, val) table with
+ * the prefix/suffix dictionary of the decoder in gif.c
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "gif.h"
+
+#define TABLE_MAX_WIDTH	12u
+#define TABLE_TERM	((uint16_t) 0xFFFF)
+
+/* Short strings (noise), runs of 128 pixels and one color - strings of up to
+   thousands of bytes */
+static const char *emit_cases[] = { "vga_mc8", "clear_256", "clear_full",
+	"large_runs", "flat" };
+
+/* Image data of the first image - codes of all sub-blocks joined together */
+typedef struct
+{
+	uint8_t *data;
+	size_t len;
+	uint32_t pixels;
+	uint8_t min_code;
+} lzw_data_t;
+
+/* Old LZW table - entry knows neither its length nor its first byte */
+typedef struct
+{
+	uint16_t row;
+	uint8_t val;
+} table_t;
+
+/* Bit reader over joined sub-blocks */
+typedef struct
+{
+	const uint8_t *pos;
+	const uint8_t *end;
+	uint32_t acc;
+	unsigned cnt;
+} codes_t;
+
+static int code_get(codes_t *c, unsigned width, uint16_t *code)
+{
+	while (c->cnt < width) {
+		if (c->pos == c->end)
+			return 0;
+		c->acc |= (uint32_t) *c->pos++ << c->cnt;
+		c->cnt += 8;
+	}
+	*code = c->acc & ((1u << width) - 1);
+	c->acc >>= width;
+	c->cnt -= width;
+
+	return 1;
+}
+
+/* Decode by the old table - string is walked from its end into temporary
+   buffer, then copied out reversed */
+static uint32_t decode_table(const lzw_data_t *d, uint8_t *out)
+{
+	static table_t table[1u << TABLE_MAX_WIDTH];
+	uint8_t tmp[1u << TABLE_MAX_WIDTH];
+	codes_t c = { .pos = d->data, .end = d->data + d->len };
+	uint16_t clear_code = 1u << d->min_code;
+	uint16_t table_size = clear_code + 2;
+	uint16_t prev = TABLE_TERM;
+	unsigned bits = d->min_code + 1;
+	uint32_t pos = 0;
+	uint16_t code, row, len;
+
+	for (unsigned i = 0; i < clear_code; i++) {
+		table[i].row = TABLE_TERM;
+		table[i].val = i;
+	}
+
+	while (code_get(&c, bits, &code) && code != clear_code + 1) {
+		if (code == clear_code) {
+			table_size = clear_code + 2;
+			bits = d->min_code + 1;
+			prev = TABLE_TERM;
+			continue;
+		}
+		if (code > table_size || (code == table_size
+			&& prev == TABLE_TERM))
+			break;
+
+		/* String of prev first - it gives the first byte of new entry
+		   and, for code not in table yet, the whole string but its
+		   last byte */
+		row = (code < table_size) ? code : prev;
+		for (len = 0; row != TABLE_TERM; row = table[row].row)
+			tmp[len++] = table[row].val;
+		if (code == table_size) {
+			memmove(tmp + 1, tmp, len);
+			tmp[0] = tmp[len++];
+		}
+
+		if (prev != TABLE_TERM
+			&& table_size < (1u << TABLE_MAX_WIDTH)) {
+			table[table_size].row = prev;
+			table[table_size].val = tmp[len - 1];
+			table_size++;
+		}
+
+		if (len > d->pixels - pos)
+			break;
+		while (len)
+			out[pos++] = tmp[--len];
+
+		if (table_size == (1u << bits) && bits < TABLE_MAX_WIDTH)
+			bits++;
+		prev = code;
+	}
+
+	return pos;
+}
+
+/* Read GIF and join sub-blocks of its first image into d */
+static int load(const char *dir, const char *name, uint8_t **buf, size_t *len,
+	lzw_data_t *d)
+{
+	char path[4096];
+	const uint8_t *p, *end;
+
+	snprintf(path, sizeof(path), "%s/%s.gif", dir, name);
+	if ((*buf = bench_read(path, len)) == NULL)
+		return 1;
+	p = *buf;
+	end = *buf + *len;
+
+	/* Header, Logical Screen Descriptor and Global Color Table */
+	if (*len < 13)
+		goto load_err;
+	if (p[10] & 0x80)
+		p += 3u << ((p[10] & 7) + 1);
+	p += 13;
+
+	/* Skip extensions up to the first Image Descriptor */
+	while (p < end && *p == 0x21) {
+		for (p += 2; p < end && *p; p += *p + 1)
+			;
+		p++;
+	}
+	if (p + 11 > end || *p != 0x2C)
+		goto load_err;
+	d->pixels = (uint32_t) (p[5] | p[6] << 8) * (p[7] | p[8] << 8);
+	if (p[9] & 0x80)
+		p += 3u << ((p[9] & 7) + 1);
+	p += 10;
+	d->min_code = *p++;
+
+	if ((d->data = (uint8_t *) malloc(end - p)) == NULL)
+		goto load_err;
+	d->len = 0;
+	while (p < end && *p && p + *p < end) {
+		memcpy(d->data + d->len, p + 1, *p);
+		d->len += *p;
+		p += *p + 1;
+	}
+
+	return 0;
+
+load_err:
+	fprintf(stderr, "%s: no image data\n", name);
+	free(*buf);
+
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	image_t img = { .data = NULL };
+	gif_ctx_t *ctx;
+	lzw_data_t d;
+	uint8_t *buf, *ref;
+	size_t len;
+	uint32_t pixels;
+	double best, t;
+	int ret = 0;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: emit_bench CORPUS_DIR\n");
+		return 1;
+	}
+
+	if ((ctx = gif_ctx_create(NULL)) == NULL) {
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(emit_cases) / sizeof(emit_cases[0]);
+		i++) {
+		if (load(argv[1], emit_cases[i], &buf, &len, &d)) {
+			ret = 1;
+			continue;
+		}
+		if ((ref = (uint8_t *) malloc(d.pixels)) == NULL) {
+			fprintf(stderr, "Not enough memory\n");
+			free(buf);
+			free(d.data);
+			ret = 1;
+			break;
+		}
+
+		best = 0;
+		for (int r = 0; r < BENCH_ROUNDS; r++) {
+			t = bench_now();
+			pixels = decode_table(&d, ref);
+			t = bench_now() - t;
+			if (r == 0 || t < best)
+				best = t;
+		}
+		bench_report("emit", emit_cases[i], "table", d.len, pixels,
+			best, 0);
+
+		/* The same codes by the decoder of gif.c, into indexed canvas
+		   (the image covers all of it) */
+		best = 0;
+		for (int r = 0; r < BENCH_ROUNDS; r++) {
+			img.format = IMG_INDEXED;
+			t = bench_now();
+			if (gif_load_mem(&img, buf, len, ctx) == 0)
+				break;
+			t = bench_now() - t;
+			if (r == 0 || t < best)
+				best = t;
+		}
+		if (img.format != IMG_INDEXED || pixels != d.pixels
+			|| (uint32_t) img.width * img.height != pixels
+			|| memcmp(img.data, ref, pixels)) {
+			fprintf(stderr, "%s: outputs differ\n", emit_cases[i]);
+			ret = 1;
+		}
+		bench_report("emit", emit_cases[i], "dict", d.len, pixels,
+			best, 0);
+
+		free(ref);
+		free(buf);
+		free(d.data);
+	}
+
+	free(img.data);
+	gif_ctx_destroy(ctx);
+
+	return ret;
+}
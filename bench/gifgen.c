@@ -0,0 +1,405 @@
+/*
+ * gifgen.c - Generate deterministic synthetic GIF corpus for benchmarks
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "bench.h"
+
+#define LZW_MAX_CODES	4096u
+#define HASH_SIZE	8192u		/* Power of 2, > LZW_MAX_CODES */
+
+/* Clear Code policy of the encoder */
+#define CLEAR_FULL	0u		/* Clear once the table is full */
+#define CLEAR_DEFER	0xFFFFu		/* Never clear - deferred clear, table
+					   stays full till the end */
+
+/* Pixel content */
+typedef enum
+{
+	CONTENT_FLAT,		/* One color */
+	CONTENT_RUNS,		/* Runs of 128 pixels of one color */
+	CONTENT_NOISE,		/* Every pixel random - worst case for LZW */
+} content_t;
+
+/* One corpus file */
+typedef struct
+{
+	const char *name;
+	uint16_t width;
+	uint16_t height;
+	uint8_t min_code;	/* 2..8 - palette of (1 << min_code) colors */
+	content_t content;
+	uint16_t clear;		/* Clear Code after every N codes, or CLEAR_* */
+	uint8_t interlace;
+	uint16_t frames;	/* More than one - animation of sub-images */
+	uint8_t huge;		/* Generated only on request */
+	uint8_t lct;		/* Every 3rd frame of animation has local
+				   color table (after one with disposal 3) */
+} corpus_t;
+
+static const corpus_t corpus[] = {
+	{ "tiny_1x1",		1,	1,	2, CONTENT_FLAT, CLEAR_FULL, 0, 1, 0, 0 },
+	{ "tiny_16x16",		16,	16,	2, CONTENT_NOISE, CLEAR_FULL, 0, 1, 0, 0 },
+	{ "vga_mc2",		640,	480,	2, CONTENT_NOISE, CLEAR_FULL, 0, 1, 0, 0 },
+	{ "vga_mc3",		640,	480,	3, CONTENT_NOISE, CLEAR_FULL, 0, 1, 0, 0 },
+	{ "vga_mc4",		640,	480,	4, CONTENT_NOISE, CLEAR_FULL, 0, 1, 0, 0 },
+	{ "vga_mc5",		640,	480,	5, CONTENT_NOISE, CLEAR_FULL, 0, 1, 0, 0 },
+	{ "vga_mc6",		640,	480,	6, CONTENT_NOISE, CLEAR_FULL, 0, 1, 0, 0 },
+	{ "vga_mc7",		640,	480,	7, CONTENT_NOISE, CLEAR_FULL, 0, 1, 0, 0 },
+	{ "vga_mc8",		640,	480,	8, CONTENT_NOISE, CLEAR_FULL, 0, 1, 0, 0 },
+	{ "clear_full",		1024,	1024,	8, CONTENT_RUNS, CLEAR_FULL, 0, 1, 0, 0 },
+	{ "clear_256",		1024,	1024,	8, CONTENT_RUNS, 256, 0, 1, 0, 0 },
+	{ "clear_1",		1024,	1024,	8, CONTENT_RUNS, 1, 0, 1, 0, 0 },
+	{ "clear_defer",	1024,	1024,	8, CONTENT_RUNS, CLEAR_DEFER, 0, 1, 0, 0 },
+	{ "flat",		1024,	1024,	8, CONTENT_FLAT, CLEAR_FULL, 0, 1, 0, 0 },
+	{ "interlace",		1024,	1024,	8, CONTENT_NOISE, CLEAR_FULL, 1, 1, 0, 0 },
+	{ "anim_50",		480,	360,	8, CONTENT_RUNS, CLEAR_FULL, 0, 50, 0, 0 },
+	{ "anim_1x1_5000",	1,	1,	2, CONTENT_FLAT, CLEAR_FULL, 0, 5000, 0, 0 },
+	{ "anim_lct",		480,	360,	8, CONTENT_RUNS, CLEAR_FULL, 0, 50, 0, 1 },
+	{ "large_noise",	3000,	3000,	8, CONTENT_NOISE, CLEAR_FULL, 0, 1, 0, 0 },
+	{ "large_runs",		3000,	3000,	8, CONTENT_RUNS, CLEAR_FULL, 0, 1, 0, 0 },
+	{ "scan_mc2",		2480,	3508,	2, CONTENT_RUNS, CLEAR_FULL, 0, 1, 0, 0 },
+	{ "huge_runs",		16384,	16384,	8, CONTENT_RUNS, CLEAR_FULL, 0, 1, 1, 0 },
+	{ "huge_noise",		16384,	16384,	8, CONTENT_NOISE, CLEAR_FULL, 0, 1, 1, 0 },
+};
+
+/* LZW encoder writing codes into data sub-blocks */
+typedef struct
+{
+	FILE *f;
+	uint32_t key[HASH_SIZE];	/* prefix << 8 | suffix */
+	uint16_t code[HASH_SIZE];
+	uint32_t stamp[HASH_SIZE];	/* Entry is valid for 'gen' only */
+	uint32_t gen;
+	uint16_t next;		/* Next free code */
+	uint16_t prefix;	/* Current string, LZW_MAX_CODES if empty */
+	uint16_t clear_code;
+	uint8_t min_code;
+	uint8_t width;
+	uint16_t clear;
+	uint32_t emitted;	/* Codes since the last Clear Code */
+	uint64_t acc;
+	unsigned cnt;
+	uint8_t block[255];
+	unsigned block_len;
+} lzw_enc_t;
+
+/* Deterministic pseudo-random number of a position */
+static uint32_t hash32(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7FEB352Du;
+	x ^= x >> 15;
+	x *= 0x846CA68Bu;
+	x ^= x >> 16;
+
+	return x;
+}
+
+static void put_byte(lzw_enc_t *e, uint8_t byte)
+{
+	e->block[e->block_len++] = byte;
+	if (e->block_len == sizeof(e->block)) {
+		fputc(e->block_len, e->f);
+		fwrite(e->block, 1, e->block_len, e->f);
+		e->block_len = 0;
+	}
+}
+
+static void put_code(lzw_enc_t *e, uint16_t code)
+{
+	e->acc |= (uint64_t) code << e->cnt;
+	e->cnt += e->width;
+	while (e->cnt >= 8) {
+		put_byte(e, e->acc & 0xFF);
+		e->acc >>= 8;
+		e->cnt -= 8;
+	}
+}
+
+static void enc_reset(lzw_enc_t *e)
+{
+	e->gen++;
+	e->next = e->clear_code + 2;
+	e->width = e->min_code + 1;
+	e->emitted = 0;
+}
+
+static void enc_init(lzw_enc_t *e, FILE *f, uint8_t min_code, uint16_t clear)
+{
+	memset(e->stamp, 0, sizeof(e->stamp));
+	e->f = f;
+	e->gen = 0;
+	e->min_code = min_code;
+	e->clear_code = 1u << min_code;
+	e->clear = clear;
+	e->prefix = LZW_MAX_CODES;
+	e->acc = 0;
+	e->cnt = 0;
+	e->block_len = 0;
+	enc_reset(e);
+	put_code(e, e->clear_code);
+}
+
+/* Emit current string and add 'string + suffix' into the table */
+static void enc_emit(lzw_enc_t *e, uint32_t slot, uint32_t key)
+{
+	put_code(e, e->prefix);
+	e->emitted++;
+
+	if (e->next < LZW_MAX_CODES) {
+		e->key[slot] = key;
+		e->code[slot] = e->next++;
+		e->stamp[slot] = e->gen;
+		if (e->next > (1u << e->width) && e->width < 12)
+			e->width++;
+	}
+	else if (e->clear != CLEAR_DEFER) {
+		put_code(e, e->clear_code);
+		enc_reset(e);
+	}
+
+	if (e->clear != CLEAR_FULL && e->clear != CLEAR_DEFER
+		&& e->emitted == e->clear && e->next < LZW_MAX_CODES) {
+		put_code(e, e->clear_code);
+		enc_reset(e);
+	}
+}
+
+static void enc_pixel(lzw_enc_t *e, uint8_t px)
+{
+	uint32_t key;
+	uint32_t slot;
+
+	if (e->prefix == LZW_MAX_CODES) {
+		e->prefix = px;
+		return;
+	}
+
+	key = (uint32_t) e->prefix << 8 | px;
+	slot = hash32(key) & (HASH_SIZE - 1);
+	while (e->stamp[slot] == e->gen) {
+		if (e->key[slot] == key) {
+			e->prefix = e->code[slot];
+			return;
+		}
+		slot = (slot + 1) & (HASH_SIZE - 1);
+	}
+
+	enc_emit(e, slot, key);
+	e->prefix = px;
+}
+
+static void enc_finish(lzw_enc_t *e)
+{
+	if (e->prefix != LZW_MAX_CODES) {
+		put_code(e, e->prefix);
+		/* Decoder adds an entry for this code too */
+		if (e->next < LZW_MAX_CODES && ++e->next > (1u << e->width)
+			&& e->width < 12)
+			e->width++;
+	}
+	put_code(e, e->clear_code + 1);
+	if (e->cnt)
+		put_byte(e, e->acc & 0xFF);
+	if (e->block_len) {
+		fputc(e->block_len, e->f);
+		fwrite(e->block, 1, e->block_len, e->f);
+	}
+	fputc(0, e->f);
+}
+
+static uint8_t pixel(const corpus_t *c, unsigned frame, uint32_t x, uint32_t y)
+{
+	uint32_t colors = 1u << c->min_code;
+	uint32_t pos = y * (uint32_t) c->width + x + frame * 7919u;
+
+	switch (c->content) {
+	case CONTENT_FLAT:
+		return frame % colors;
+	case CONTENT_RUNS:
+		return hash32(pos / 128u) % colors;
+	default:
+		return hash32(pos) % colors;
+	}
+}
+
+static void put_u16(FILE *f, uint16_t val)
+{
+	fputc(val & 0xFF, f);
+	fputc(val >> 8, f);
+}
+
+/* Color table - every seed gives different colors */
+static void put_colors(FILE *f, unsigned colors, unsigned seed)
+{
+	for (unsigned i = 0; i < colors; i++) {
+		uint32_t rgb = hash32(i + 1 + seed * 65536u);
+		fputc(rgb & 0xFF, f);
+		fputc((rgb >> 8) & 0xFF, f);
+		fputc((rgb >> 16) & 0xFF, f);
+	}
+}
+
+/* Row order of interlaced image */
+static uint32_t interlace_row(uint32_t i, uint16_t height)
+{
+	static const uint8_t start[4] = { 0, 4, 2, 1 };
+	static const uint8_t step[4] = { 8, 8, 4, 2 };
+
+	for (int pass = 0; pass < 4; pass++) {
+		uint32_t rows = (height > start[pass]) ?
+			(height - start[pass] + step[pass] - 1) / step[pass] : 0;
+		if (i < rows)
+			return start[pass] + i * step[pass];
+		i -= rows;
+	}
+
+	return 0;
+}
+
+static int generate(const corpus_t *c, const char *dir, lzw_enc_t *e,
+	uint64_t *pixels)
+{
+	char path[4096];
+	unsigned colors = 1u << c->min_code;
+	uint16_t left, top, width, height;
+	int lct;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s.gif", dir, c->name);
+	if ((f = fopen(path, "wb")) == NULL) {
+		fprintf(stderr, "Error: opening file '%s': %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	/* Header, Logical Screen Descriptor, Global Color Table */
+	fwrite("GIF89a", 1, 6, f);
+	put_u16(f, c->width);
+	put_u16(f, c->height);
+	fputc(0x80 | 0x70 | (c->min_code - 1), f);
+	fputc(0, f);
+	fputc(0, f);
+	put_colors(f, colors, 0);
+
+	/* Looping animation */
+	if (c->frames > 1)
+		fwrite("\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 1, 19, f);
+
+	*pixels = 0;
+	for (unsigned n = 0; n < c->frames; n++) {
+		/* Later frames are quarter sized, moving, every other one is
+		   transparent, disposal methods take turns */
+		left = top = 0;
+		width = c->width;
+		height = c->height;
+		if (n > 0 && c->width > 1) {
+			width = c->width / 2;
+			height = c->height / 2;
+			left = (n * 37u) % (c->width - width + 1);
+			top = (n * 23u) % (c->height - height + 1);
+		}
+		if (c->frames > 1) {
+			fwrite("\x21\xF9\x04", 1, 3, f);
+			fputc(((n % 3 + 1) << 2) | (n % 2), f);
+			put_u16(f, 4);
+			fputc(0, f);
+			fputc(0, f);
+		}
+
+		/* Image Descriptor */
+		fputc(0x2C, f);
+		put_u16(f, left);
+		put_u16(f, top);
+		put_u16(f, width);
+		put_u16(f, height);
+		lct = c->lct && n > 0 && n % 3 == 0;
+		fputc(((c->interlace) ? 0x40 : 0)
+			| ((lct) ? 0x80 | (c->min_code - 1) : 0), f);
+		if (lct)
+			put_colors(f, colors, n);
+
+		fputc(c->min_code, f);
+		enc_init(e, f, c->min_code, c->clear);
+		for (uint32_t i = 0; i < height; i++) {
+			uint32_t y = (c->interlace) ? interlace_row(i, height) : i;
+			for (uint32_t x = 0; x < width; x++)
+				enc_pixel(e, pixel(c, n, x, y));
+		}
+		enc_finish(e);
+		*pixels += (uint64_t) width * height;
+	}
+
+	fputc(0x3B, f);
+
+	if (fclose(f)) {
+		fprintf(stderr, "Error: writing file '%s'\n", path);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char path[4096];
+	const char *dir;
+	int huge = 0;
+	lzw_enc_t *e;
+	FILE *f_manifest;
+	uint64_t pixels;
+	int ret = 0;
+
+	if (argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "huge"))) {
+		fprintf(stderr, "usage: gifgen DIR [huge]\n");
+		return 1;
+	}
+	dir = argv[1];
+	huge = (argc == 3);
+
+	mkdir(dir, 0777);
+	snprintf(path, sizeof(path), "%s/" BENCH_MANIFEST, dir);
+	if ((f_manifest = fopen(path, "w")) == NULL) {
+		fprintf(stderr, "Error: opening file '%s': %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	if ((e = (lzw_enc_t *) malloc(sizeof(lzw_enc_t))) == NULL) {
+		fprintf(stderr, "Not enough memory\n");
+		fclose(f_manifest);
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); i++) {
+		if (corpus[i].huge && !huge)
+			continue;
+		if (generate(&corpus[i], dir, e, &pixels)) {
+			ret = 1;
+			break;
+		}
+		fprintf(f_manifest, "%s\t%u\t%u\t%u\t%llu\n", corpus[i].name,
+			corpus[i].width, corpus[i].height, corpus[i].frames,
+			(unsigned long long) pixels);
+	}
+
+	free(e);
+	if (fclose(f_manifest))
+		ret = 1;
+
+	return ret;
+}
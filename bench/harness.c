@@ -0,0 +1,139 @@
+/*
+ * harness.c - End-to-end benchmark - run converter over the whole corpus
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+/* Converter options measured for every file */
+static const struct
+{
+	const char *name;
+	const char *opt;	/* NULL - no option */
+	int still;		/* First image only - skipped for animations */
+} modes[] = {
+	{ "default", NULL, 0 },
+	{ "palette", "-p", 0 },
+	{ "stream", "-t", 1 },
+};
+
+/* Run converter once, returns wall time or -1 on failure */
+static double run(const char *exec, const char *input, const char *opt,
+	long *maxrss_kb)
+{
+	struct rusage usage;
+	double t;
+	pid_t pid;
+	int status;
+	int fd;
+
+	t = bench_now();
+	if ((pid = fork()) < 0)
+		return -1;
+
+	if (pid == 0) {
+		/* Extension messages are not interesting here */
+		if ((fd = open("/dev/null", O_WRONLY)) >= 0)
+			dup2(fd, STDERR_FILENO);
+		if (opt)
+			execl(exec, exec, "-i", input, "-o", "/dev/null", opt,
+				(char *) NULL);
+		else
+			execl(exec, exec, "-i", input, "-o", "/dev/null",
+				(char *) NULL);
+		_exit(127);
+	}
+
+	if (wait4(pid, &status, 0, &usage) != pid)
+		return -1;
+	t = bench_now() - t;
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		return -1;
+	*maxrss_kb = usage.ru_maxrss;
+
+	return t;
+}
+
+int main(int argc, char *argv[])
+{
+	char path[4096];
+	char name[256];
+	unsigned width, height, frames;
+	unsigned long long pixels;
+	struct stat st;
+	FILE *f_manifest;
+	double best, t;
+	long maxrss, rss;
+	int ret = 0;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: harness GIF2BMP CORPUS_DIR\n");
+		return 1;
+	}
+
+	snprintf(path, sizeof(path), "%s/" BENCH_MANIFEST, argv[2]);
+	if ((f_manifest = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "Error: opening file '%s': %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	while (fscanf(f_manifest, "%255s %u %u %u %llu", name, &width, &height,
+		&frames, &pixels) == 5) {
+		snprintf(path, sizeof(path), "%s/%s.gif", argv[2], name);
+		if (stat(path, &st)) {
+			fprintf(stderr, "Error: '%s': %s\n", path,
+				strerror(errno));
+			ret = 1;
+			continue;
+		}
+
+		for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+			if (modes[m].still && frames > 1)
+				continue;
+
+			best = 0;
+			maxrss = 0;
+			for (int r = 0; r < BENCH_ROUNDS; r++) {
+				if ((t = run(argv[1], path, modes[m].opt,
+					&rss)) < 0)
+					break;
+				if (r == 0 || t < best)
+					best = t;
+				if (rss > maxrss)
+					maxrss = rss;
+			}
+			if (t < 0) {
+				fprintf(stderr, "%s (%s): conversion failed\n",
+					name, modes[m].name);
+				ret = 1;
+				continue;
+			}
+
+			bench_report("e2e", name, modes[m].name, st.st_size,
+				pixels, best, maxrss);
+		}
+	}
+
+	fclose(f_manifest);
+
+	return ret;
+}
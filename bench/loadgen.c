@@ -0,0 +1,219 @@
+/*
+ * loadgen.c - Load generator for server mode - latency of requests
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "bench.h"
+#include "serve.h"
+
+/* Small image shows per-request overhead, the bigger one throughput */
+static const char *cases[] = { "tiny_16x16", "vga_mc8" };
+static const unsigned clients[] = { 1, 4 };
+
+#define REQUESTS	200	/* Per client */
+
+/* One client - own connection, sends the same GIF REQUESTS times */
+typedef struct
+{
+	const char *s_socket;
+	const uint8_t *gif;
+	uint32_t len;
+	double *lat;		/* Latency of every request */
+	int err;
+	pthread_t thread;
+} client_t;
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	ssize_t cnt;
+
+	while (len > 0) {
+		if ((cnt = recv(fd, buf, len, 0)) <= 0)
+			return 1;
+		buf = (uint8_t *) buf + cnt;
+		len -= cnt;
+	}
+
+	return 0;
+}
+
+static uint32_t get_u32(const uint8_t *buf)
+{
+	return buf[0] | buf[1] << 8 | (uint32_t) buf[2] << 16
+		| (uint32_t) buf[3] << 24;
+}
+
+/* Server may be still starting - retry for a while */
+static int connect_server(const char *s_socket)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct timespec wait = { 0, 10000000 };
+	int fd;
+
+	strncpy(addr.sun_path, s_socket, sizeof(addr.sun_path) - 1);
+
+	for (int i = 0; i < 200; i++) {
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+			return -1;
+		if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0)
+			return fd;
+		close(fd);
+		nanosleep(&wait, NULL);
+	}
+
+	fprintf(stderr, "loadgen: '%s': %s\n", s_socket, strerror(errno));
+
+	return -1;
+}
+
+static void *client_run(void *arg)
+{
+	client_t *c = (client_t *) arg;
+	uint8_t header[SERVE_HEADER_SIZE];
+	uint8_t resp[SERVE_RESP_SIZE];
+	uint8_t *bmp = NULL;
+	size_t bmp_size = 0;
+	uint32_t len;
+	double t;
+	int fd;
+
+	if ((fd = connect_server(c->s_socket)) < 0) {
+		c->err = 1;
+		return NULL;
+	}
+
+	header[0] = c->len;
+	header[1] = c->len >> 8;
+	header[2] = c->len >> 16;
+	header[3] = c->len >> 24;
+
+	for (int r = 0; r < REQUESTS; r++) {
+		t = bench_now();
+		if (send(fd, header, sizeof(header), 0) != sizeof(header)
+			|| send(fd, c->gif, c->len, 0) != c->len
+			|| read_full(fd, resp, sizeof(resp))
+			|| get_u32(resp) != SERVE_OK) {
+			c->err = 1;
+			break;
+		}
+		len = get_u32(resp + 4);
+		if (bmp_size < len) {
+			free(bmp);
+			if ((bmp = (uint8_t *) malloc(len)) == NULL) {
+				c->err = 1;
+				break;
+			}
+			bmp_size = len;
+		}
+		if (read_full(fd, bmp, len)) {
+			c->err = 1;
+			break;
+		}
+		c->lat[r] = bench_now() - t;
+	}
+
+	free(bmp);
+	close(fd);
+
+	return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+static int run(const char *s_socket, const char *dir, const char *name,
+	unsigned n)
+{
+	char path[4096];
+	char variant[32];
+	client_t c[n];
+	double *lat;
+	uint8_t *gif;
+	size_t len;
+	uint64_t pixels = bench_pixels(dir, name);
+	unsigned total = n * REQUESTS;
+	double t;
+	int ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s.gif", dir, name);
+	if ((gif = bench_read(path, &len)) == NULL)
+		return 1;
+	if ((lat = (double *) malloc(total * sizeof(double))) == NULL) {
+		free(gif);
+		return 1;
+	}
+
+	t = bench_now();
+	for (unsigned i = 0; i < n; i++) {
+		c[i] = (client_t) { .s_socket = s_socket, .gif = gif,
+			.len = len, .lat = lat + i * REQUESTS };
+		if (pthread_create(&c[i].thread, NULL, client_run, &c[i]))
+			c[i].err = 2;
+	}
+	for (unsigned i = 0; i < n; i++) {
+		if (c[i].err != 2)
+			pthread_join(c[i].thread, NULL);
+		ret |= c[i].err;
+	}
+	t = bench_now() - t;
+
+	if (ret) {
+		fprintf(stderr, "%s: requests failed\n", name);
+		goto run_err;
+	}
+
+	/* Latency percentiles of single request, then throughput of all */
+	qsort(lat, total, sizeof(double), cmp_double);
+	snprintf(variant, sizeof(variant), "p50-c%u", n);
+	bench_report("serve", name, variant, len, pixels, lat[total / 2], 0);
+	snprintf(variant, sizeof(variant), "p99-c%u", n);
+	bench_report("serve", name, variant, len, pixels,
+		lat[total * 99 / 100], 0);
+	snprintf(variant, sizeof(variant), "all-c%u", n);
+	bench_report("serve", name, variant, (uint64_t) len * total,
+		pixels * total, t, 0);
+
+run_err:
+	free(lat);
+	free(gif);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = 0;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: loadgen SOCKET CORPUS_DIR\n");
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+		for (size_t j = 0; j < sizeof(clients) / sizeof(clients[0]); j++)
+			ret |= run(argv[1], argv[2], cases[i], clients[j]);
+
+	return ret;
+}
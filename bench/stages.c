@@ -0,0 +1,410 @@
+/*
+ * stages.c - Microbenchmarks of single conversion stages
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "bench.h"
+#include "gif.h"
+#include "bmp.h"
+#include "pipe.h"
+
+/* Parsing - tiny images, so nearly all the time is spent in blocks and
+   extensions rather than in LZW */
+static const char *parse_cases[] = { "anim_1x1_5000", "tiny_16x16" };
+/* LZW - large images decoded into indexed canvas (no color lookup), by the
+   decoder of every minimum code size */
+static const char *lzw_cases[] = { "vga_mc2", "vga_mc3", "vga_mc4",
+	"vga_mc5", "vga_mc6", "vga_mc7", "vga_mc8", "scan_mc2", "clear_1",
+	"clear_defer", "large_runs", "large_noise" };
+/* Probe - blocks walked, image data skipped */
+static const char *probe_cases[] = { "anim_50", "vga_mc8", "large_noise" };
+/* Animation - decoded by the calling thread only, then by frame workers */
+static const char *frames_cases[] = { "anim_50" };
+/* BMP writing - decoded once, then written in every pixel format (indexed
+   scan_mc2 is packed into 4bpp) */
+static const char *bmp_cases[] = { "large_noise", "scan_mc2" };
+/* Pipeline - read from regular file and streamed as BMP to storage of
+   SLOW_MBPS, by the calling thread only, then by three threads */
+static const char *pipe_cases[] = { "large_noise", "scan_mc2" };
+
+#define SLOW_MBPS	200
+#define SLOW_CHUNK	(1u << 16)	/* Writer sleeps once per this many bytes */
+
+static const struct
+{
+	const char *name;
+	img_format_t format;
+} formats[] = {
+	{ "rgb", IMG_RGB },
+	{ "bgr", IMG_BGR },
+	{ "indexed", IMG_INDEXED },
+	{ "bgra", IMG_BGRA },
+};
+
+static int load(const char *dir, const char *name, uint8_t **buf, size_t *len)
+{
+	char path[4096];
+
+	snprintf(path, sizeof(path), "%s/%s.gif", dir, name);
+
+	return (*buf = bench_read(path, len)) == NULL;
+}
+
+/* Best time of decoding buf into img of given format */
+static double decode(gif_ctx_t *ctx, image_t *img, img_format_t format,
+	const uint8_t *buf, size_t len)
+{
+	double best = 0;
+	double t;
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		img->format = format;
+		t = bench_now();
+		if (gif_load_mem(img, buf, len, ctx) == 0)
+			return -1;
+		t = bench_now() - t;
+		if (r == 0 || t < best)
+			best = t;
+	}
+
+	return best;
+}
+
+static int bench_decode(const char *stage, const char *dir,
+	const char *name, img_format_t format, gif_ctx_t *ctx, image_t *img)
+{
+	uint8_t *buf;
+	size_t len;
+	double t;
+
+	if (load(dir, name, &buf, &len))
+		return 1;
+
+	t = decode(ctx, img, format, buf, len);
+	free(buf);
+	if (t < 0) {
+		fprintf(stderr, "%s: decoding failed\n", name);
+		return 1;
+	}
+
+	bench_report(stage, name, (format == IMG_INDEXED) ? "indexed" : "rgb",
+		len, bench_pixels(dir, name), t, 0);
+
+	return 0;
+}
+
+static int bench_probe(const char *dir, const char *name)
+{
+	gif_info_t info;
+	uint8_t *buf;
+	size_t len;
+	double best = 0;
+	double t;
+
+	if (load(dir, name, &buf, &len))
+		return 1;
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		t = bench_now();
+		if (gif_probe_mem(&info, buf, len) == 0) {
+			fprintf(stderr, "%s: probing failed\n", name);
+			free(buf);
+			return 1;
+		}
+		t = bench_now() - t;
+		if (r == 0 || t < best)
+			best = t;
+	}
+	free(buf);
+
+	bench_report("probe", name, "info", len, bench_pixels(dir, name), best,
+		0);
+
+	return 0;
+}
+
+static int bench_frames(const char *dir, const char *name, gif_ctx_t *ctx,
+	image_t *img)
+{
+	gif_opts_t opts = { .row_sink = NULL };
+	uint8_t *buf;
+	size_t len;
+	char variant[32];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned threads = (cpus > 2) ? cpus : 2;
+	double t;
+	int ret = 0;
+
+	if (load(dir, name, &buf, &len))
+		return 1;
+
+	for (unsigned n = 1; n <= threads; n += threads - 1) {
+		opts.threads = n;
+		gif_ctx_set_opts(ctx, &opts);
+		if ((t = decode(ctx, img, IMG_RGB, buf, len)) < 0) {
+			fprintf(stderr, "%s: decoding failed\n", name);
+			ret = 1;
+			break;
+		}
+
+		snprintf(variant, sizeof(variant), (n == 1) ? "rgb-seq"
+			: "rgb-j%u", n);
+		bench_report("frames", name, variant, len,
+			bench_pixels(dir, name), t, 0);
+	}
+
+	opts.threads = 0;
+	gif_ctx_set_opts(ctx, &opts);
+	free(buf);
+
+	return ret;
+}
+
+/* Best time of writing img into regular file - by stdio if threads is 1,
+   otherwise through mapping filled in by threads */
+static double write_file(const char *dir, const image_t *img, unsigned threads,
+	size_t *bmp_len)
+{
+	char path[4096];
+	FILE *f_bmp;
+	double best = 0;
+	double t;
+
+	snprintf(path, sizeof(path), "%s/stages.bmp", dir);
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		if ((f_bmp = fopen(path, "w+b")) == NULL)
+			return -1;
+		t = bench_now();
+		*bmp_len = bmp_save(img, f_bmp, threads, NULL, NULL);
+		fflush(f_bmp);
+		t = bench_now() - t;
+		fclose(f_bmp);
+		if (r == 0 || t < best)
+			best = t;
+	}
+	remove(path);
+
+	return best;
+}
+
+static int bench_bmp(const char *dir, const char *name, gif_ctx_t *ctx,
+	image_t *img)
+{
+	uint8_t *buf;
+	size_t len;
+	size_t bmp_len = 0;
+	FILE *f_null;
+	char variant[32];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned threads = (cpus > 2) ? cpus : 2;
+	double best, t;
+	int ret = 0;
+
+	if (load(dir, name, &buf, &len))
+		return 1;
+
+	if ((f_null = fopen("/dev/null", "wb")) == NULL) {
+		free(buf);
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		img->format = formats[i].format;
+		if (gif_load_mem(img, buf, len, ctx) == 0) {
+			fprintf(stderr, "%s: decoding failed\n", name);
+			ret = 1;
+			break;
+		}
+
+		/* Row by row through stdio */
+		best = 0;
+		for (int r = 0; r < BENCH_ROUNDS; r++) {
+			rewind(f_null);
+			t = bench_now();
+			bmp_len = bmp_save(img, f_null, 1, NULL, NULL);
+			fflush(f_null);
+			t = bench_now() - t;
+			if (r == 0 || t < best)
+				best = t;
+		}
+		if (bmp_len == 0) {
+			ret = 1;
+			break;
+		}
+
+		bench_report("bmp", name, formats[i].name, bmp_len,
+			(uint64_t) img->width * img->height, best, 0);
+
+		/* Regular file, written by stdio and by several threads */
+		for (unsigned n = 1; n <= threads; n += threads - 1) {
+			if ((best = write_file(dir, img, n, &bmp_len)) < 0
+				|| bmp_len == 0) {
+				ret = 1;
+				break;
+			}
+
+			snprintf(variant, sizeof(variant), (n == 1) ? "%s-file"
+				: "%s-map%u", formats[i].name, n);
+			bench_report("bmp", name, variant, bmp_len,
+				(uint64_t) img->width * img->height, best, 0);
+		}
+		if (ret)
+			break;
+	}
+
+	fclose(f_null);
+	free(buf);
+
+	return ret;
+}
+
+/* bmp_write_fn of slow storage - bytes are dropped, writer sleeps as long
+   as storage of SLOW_MBPS would take to write them */
+static int slow_write(void *opaque, const void *data, size_t len)
+{
+	size_t *debt = (size_t *) opaque;
+	struct timespec ts;
+	long ns;
+
+	(void) data;
+	for (*debt += len; *debt >= SLOW_CHUNK; *debt -= SLOW_CHUNK) {
+		ns = (long) (SLOW_CHUNK * 1000.0 / SLOW_MBPS);
+		ts.tv_sec = ns / 1000000000L;
+		ts.tv_nsec = ns % 1000000000L;
+		nanosleep(&ts, NULL);
+	}
+
+	return 0;
+}
+
+/* Best time of converting file into slow storage, pipelined or not */
+static double convert_slow(FILE *f_gif, gif_ctx_t *ctx, image_t *img,
+	int pipelined, size_t *bmp_len)
+{
+	gif_opts_t opts = { .row_sink = bmp_stream_row };
+	bmp_stream_t bmp;
+	pipe_t p;
+	size_t debt;
+	size_t ret;
+	double best = 0;
+	double t;
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		rewind(f_gif);
+		debt = 0;
+		img->format = IMG_BGR;
+		t = bench_now();
+		bmp_stream_open_cb(&bmp, slow_write, &debt, NULL, NULL);
+		opts.opaque = &bmp;
+		if (pipelined) {
+			if (pipe_open(&p, f_gif, bmp_stream_row, &bmp, NULL))
+				return -1;
+			opts.row_sink = pipe_row;
+			opts.opaque = &p;
+			gif_ctx_set_opts(ctx, &opts);
+			ret = pipe_load(&p, img, ctx);
+			ret = pipe_close(&p, NULL) == 0 && ret;
+		}
+		else {
+			gif_ctx_set_opts(ctx, &opts);
+			ret = gif_load(img, f_gif, ctx);
+		}
+		*bmp_len = bmp_stream_close(&bmp, img);
+		t = bench_now() - t;
+		opts.row_sink = bmp_stream_row;
+		if (ret == 0 || *bmp_len == 0)
+			return -1;
+		if (r == 0 || t < best)
+			best = t;
+	}
+
+	return best;
+}
+
+static int bench_pipe(const char *dir, const char *name, gif_ctx_t *ctx,
+	image_t *img)
+{
+	static const gif_opts_t defaults;
+	char path[4096];
+	FILE *f_gif;
+	size_t bmp_len = 0;
+	double t;
+	int ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s.gif", dir, name);
+	if ((f_gif = fopen(path, "rb")) == NULL)
+		return 1;
+
+	for (int pipelined = 0; pipelined <= 1; pipelined++) {
+		if ((t = convert_slow(f_gif, ctx, img, pipelined, &bmp_len))
+			< 0) {
+			fprintf(stderr, "%s: conversion failed\n", name);
+			ret = 1;
+			break;
+		}
+		bench_report("pipe", name, (pipelined) ? "pipeline" : "stream",
+			bmp_len, bench_pixels(dir, name), t, 0);
+	}
+
+	gif_ctx_set_opts(ctx, &defaults);
+	fclose(f_gif);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	image_t img = { .data = NULL };
+	gif_ctx_t *ctx;
+	int ret = 0;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: stages CORPUS_DIR\n");
+		return 1;
+	}
+
+	if ((ctx = gif_ctx_create(NULL)) == NULL) {
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(parse_cases) / sizeof(parse_cases[0]); i++)
+		ret |= bench_decode("parse", argv[1], parse_cases[i],
+			IMG_INDEXED, ctx, &img);
+
+	for (size_t i = 0; i < sizeof(lzw_cases) / sizeof(lzw_cases[0]); i++)
+		ret |= bench_decode("lzw", argv[1], lzw_cases[i], IMG_INDEXED,
+			ctx, &img);
+
+	for (size_t i = 0; i < sizeof(probe_cases) / sizeof(probe_cases[0]); i++)
+		ret |= bench_probe(argv[1], probe_cases[i]);
+
+	for (size_t i = 0; i < sizeof(frames_cases) / sizeof(frames_cases[0]);
+		i++)
+		ret |= bench_frames(argv[1], frames_cases[i], ctx, &img);
+
+	for (size_t i = 0; i < sizeof(bmp_cases) / sizeof(bmp_cases[0]); i++)
+		ret |= bench_bmp(argv[1], bmp_cases[i], ctx, &img);
+
+	for (size_t i = 0; i < sizeof(pipe_cases) / sizeof(pipe_cases[0]); i++)
+		ret |= bench_pipe(argv[1], pipe_cases[i], ctx, &img);
+
+	gif_ctx_destroy(ctx);
+	free(img.data);
+
+	return ret;
+}
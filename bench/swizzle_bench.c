@@ -0,0 +1,102 @@
+/*
+ * swizzle_bench.c - Compare throughput of RGB to BGR kernels on large image
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "swizzle.h"
+
+#define WIDTH	4096u
+#define HEIGHT	4096u
+
+/* Per-byte loop bmp_save() used before the kernels */
+static void swizzle_loop(uint8_t *dst, const uint8_t *src, uint32_t pixels)
+{
+	for (uint32_t i = 0; i < pixels; i++) {
+		dst[i * 3 + 0] = src[i * 3 + 2];
+		dst[i * 3 + 1] = src[i * 3 + 1];
+		dst[i * 3 + 2] = src[i * 3 + 0];
+	}
+}
+
+/* Best of BENCH_ROUNDS passes over whole image, row by row as bmp_save() */
+static double run(swizzle_fn fn, uint8_t *dst, const uint8_t *src)
+{
+	double best = 0;
+	double t;
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		t = bench_now();
+		for (uint32_t y = 0; y < HEIGHT; y++)
+			fn(dst + (size_t) y * WIDTH * 3, src + (size_t) y
+				* WIDTH * 3, WIDTH);
+		t = bench_now() - t;
+		if (r == 0 || t < best)
+			best = t;
+	}
+
+	return best;
+}
+
+int main(void)
+{
+	struct
+	{
+		const char *name;
+		swizzle_fn fn;
+	} kernels[] = {
+		{ "loop", swizzle_loop },
+		{ "scalar", swizzle_scalar },
+#ifdef SWIZZLE_X86
+		{ "ssse3", __builtin_cpu_supports("ssse3") ?
+			swizzle_ssse3 : NULL },
+		{ "avx2", __builtin_cpu_supports("avx2") ?
+			swizzle_avx2 : NULL },
+#endif
+	};
+	size_t size = (size_t) WIDTH * HEIGHT * 3;
+	uint8_t *src = malloc(size);
+	uint8_t *ref = malloc(size);
+	uint8_t *dst = malloc(size);
+	double t;
+	int ret = 0;
+
+	if (!src || !ref || !dst) {
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+
+	srand(1);
+	for (size_t i = 0; i < size; i++)
+		src[i] = rand();
+	swizzle_loop(ref, src, WIDTH * HEIGHT);
+
+	for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+		if (kernels[k].fn == NULL)
+			continue;
+
+		memset(dst, 0, size);
+		t = run(kernels[k].fn, dst, src);
+		if (memcmp(dst, ref, size)) {
+			fprintf(stderr, "%s: wrong output\n", kernels[k].name);
+			ret = 1;
+		}
+		bench_report("swizzle", "4096x4096", kernels[k].name, size,
+			(uint64_t) WIDTH * HEIGHT, t, 0);
+	}
+
+	free(src);
+	free(ref);
+	free(dst);
+
+	return ret;
+}
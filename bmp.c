@@ -8,12 +8,21 @@
  * published by the Free Software Foundation.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "bmp.h"
+#include "swizzle.h"
 
 /* BMP header */
 struct BMP_header
@@ -29,8 +38,8 @@ struct BMP_header
 struct DIB_header
 {
 	uint32_t head_size;
-	uint32_t width;
-	uint32_t height;
+	int32_t width;
+	int32_t height;		/* negative for top-down images */
 	uint16_t planes;
 	uint16_t bpp;
 	uint32_t compression;
@@ -41,109 +50,653 @@ struct DIB_header
 	uint32_t high_colors;	/* number of important colors */
 } __attribute__((packed));
 
+/* Rest of DIB header version BITMAPV4HEADER - channel masks of 32bpp
+   pixels, the alpha one included */
+struct DIB_v4_header
+{
+	uint32_t red_mask;
+	uint32_t green_mask;
+	uint32_t blue_mask;
+	uint32_t alpha_mask;
+	uint32_t cs_type;	/* Color space */
+	uint8_t endpoints[36];	/* CIE endpoints (unused for sRGB) */
+	uint32_t gamma_red;
+	uint32_t gamma_green;
+	uint32_t gamma_blue;
+} __attribute__((packed));
+
+#define BI_RGB		0u
+#define BI_BITFIELDS	3u
+#define LCS_SRGB	0x73524742u	/* 'sRGB' */
+
+/* Color Table entry */
+struct BMP_ct
+{
+	uint8_t b;
+	uint8_t g;
+	uint8_t r;
+	uint8_t reserved;
+} __attribute__((packed));
+
 #define SIZE_BMP_HEADER		(sizeof(struct BMP_header))
 #define SIZE_DIB_HEADER		(sizeof(struct DIB_header))
+#define SIZE_DIB_V4_HEADER	(sizeof(struct DIB_v4_header))
+/* 32bpp pixels carry alpha - their masks go into BITMAPV4HEADER */
+#define SIZE_DIB(bpp)		(SIZE_DIB_HEADER + \
+				(((bpp) == 32) ? SIZE_DIB_V4_HEADER : 0u))
 #define SIZE_ROW_PADDING(w)	(((w) % 4 == 0) ? (w) : ((w) + 4 - (w) % 4))
+#define SIZE_ROW(w, bpp)	SIZE_ROW_PADDING(((uint32_t) (w) * (bpp) + 7u) / 8u)
+#define SIZE_COLOR_TABLE(bpp)	(((bpp) <= 8) ? \
+				(sizeof(struct BMP_ct) << (bpp)) : 0u)
+
+/* Palettized images are stored with the smallest sufficient depth */
+static uint16_t get_bpp(const image_t *img)
+{
+	if (img->format == IMG_BGRA)
+		return 32;
+	if (img->format != IMG_INDEXED)
+		return 24;
+	if (img->colors <= 2)
+		return 1;
+	if (img->colors <= 16)
+		return 4;
+
+	return 8;
+}
+
+static uint64_t get_bmp_size(const image_t *img)
+{
+	uint16_t bpp = get_bpp(img);
+
+	return SIZE_BMP_HEADER + SIZE_DIB(bpp) + SIZE_COLOR_TABLE(bpp)
+		+ (uint64_t) SIZE_ROW(img->width, bpp) * img->height;
+}
 
 static void set_bmp_header(struct BMP_header *header, const image_t *img)
 {
 	assert(header);
 	assert(img);
+	uint16_t bpp = get_bpp(img);
 
 	header->signature[0] = 'B';
 	header->signature[1] = 'M';
-	header->size = SIZE_BMP_HEADER + SIZE_DIB_HEADER
-		+ SIZE_ROW_PADDING(img->width) * img->height;
+	header->size = get_bmp_size(img);
 	header->reserved1 = 0;
 	header->reserved2 = 0;
-	header->offset = SIZE_BMP_HEADER + SIZE_DIB_HEADER;
+	header->offset = SIZE_BMP_HEADER + SIZE_DIB(bpp)
+		+ SIZE_COLOR_TABLE(bpp);
 }
 
-static void set_dip_header(struct DIB_header *header, const image_t *img)
+static void set_dip_header(struct DIB_header *header, const image_t *img,
+	int top_down)
 {
 	assert(header);
 	assert(img);
+	uint16_t bpp = get_bpp(img);
 
-	header->head_size = SIZE_DIB_HEADER;
+	header->head_size = SIZE_DIB(bpp);
 	header->width = img->width;
-	header->height = img->height;
+	header->height = (top_down) ? -(int32_t) img->height : img->height;
 	header->planes = 1;
-	header->bpp = 24;
-	header->compression = 0;
-	header->img_size = SIZE_ROW_PADDING(img->width) * img->height;
+	header->bpp = bpp;
+	header->compression = (bpp == 32) ? BI_BITFIELDS : BI_RGB;
+	header->img_size = SIZE_ROW(img->width, bpp) * img->height;
 	header->h_res = 2835;
 	header->v_res = 2835;
-	header->colors = 0;
+	header->colors = (bpp <= 8) ? 1u << bpp : 0;
 	header->high_colors = 0;
 }
 
-size_t bmp_save(const image_t *p_img, FILE *f_bmp)
+/* BGRA pixels are stored as they are in memory */
+static void set_dib_v4_header(struct DIB_v4_header *header)
+{
+	assert(header);
+	uint8_t a[4] = { 0, 0, 0, 0xFF };
+	uint8_t r[4] = { 0, 0, 0xFF, 0 };
+	uint8_t g[4] = { 0, 0xFF, 0, 0 };
+	uint8_t b[4] = { 0xFF, 0, 0, 0 };
+
+	memset(header, 0, sizeof(struct DIB_v4_header));
+	memcpy(&header->red_mask, r, 4);
+	memcpy(&header->green_mask, g, 4);
+	memcpy(&header->blue_mask, b, 4);
+	memcpy(&header->alpha_mask, a, 4);
+	header->cs_type = LCS_SRGB;
+}
+
+static void set_color_table(struct BMP_ct *table, const image_t *img)
+{
+	assert(table);
+	assert(img);
+	unsigned size = 1u << get_bpp(img);
+
+	for (unsigned i = 0; i < size; i++) {
+		table[i].b = img->palette[i * 3 + 2];
+		table[i].g = img->palette[i * 3 + 1];
+		table[i].r = img->palette[i * 3 + 0];
+		table[i].reserved = 0;
+	}
+}
+
+/* Entry drawn for indices outside of color table - the darkest one, so it
+   is black (as on RGB canvas) whenever the table has room for it: entries
+   past img->colors are zeros */
+static uint8_t get_fill(const image_t *img, uint16_t bpp)
+{
+	const uint8_t *pal = img->palette;
+	unsigned best = 0;
+
+	/* 8 bpp table has all 256 entries (other depths have no table) */
+	if (bpp > 4)
+		return 0;
+
+	for (unsigned i = 1; i < 1u << bpp; i++) {
+		if (pal[i * 3] + pal[i * 3 + 1] + pal[i * 3 + 2] < pal[best * 3]
+			+ pal[best * 3 + 1] + pal[best * 3 + 2])
+			best = i;
+	}
+
+	return best;
+}
+
+/* Pack indices of 2 color image - every 8 pixels give one whole byte, so
+   the output is stored rather than or-ed bit by bit */
+static void pack_1bpp(uint8_t *dst, const uint8_t *src, uint16_t width,
+	uint16_t colors, uint8_t fill)
+{
+	uint16_t x = 0;
+	uint8_t byte;
+
+#define INDEX(i)	((src[i] < colors) ? src[i] : fill)
+	for (; x + 8u <= width; x += 8u) {
+		byte = 0;
+		for (unsigned b = 0; b < 8; b++)
+			byte = byte << 1 | INDEX(x + b);
+		*dst++ = byte;
+	}
+
+	/* Last pixels are in the high bits */
+	if (x < width) {
+		byte = 0;
+		for (unsigned b = 0; b < 8; b++)
+			byte = byte << 1 | ((x + b < width) ? INDEX(x + b) : 0);
+		*dst = byte;
+	}
+}
+
+/* Pack indices of up to 16 color image - two pixels per byte */
+static void pack_4bpp(uint8_t *dst, const uint8_t *src, uint16_t width,
+	uint16_t colors, uint8_t fill)
+{
+	uint16_t x = 0;
+
+	for (; x + 2u <= width; x += 2u)
+		*dst++ = INDEX(x) << 4 | INDEX(x + 1);
+
+	if (x < width)
+		*dst = INDEX(x) << 4;
+#undef INDEX
+}
+
+/* Convert one image row into BMP row, including padding - fill is entry of
+   out of range indices (get_fill()) */
+static void pack_row(uint8_t *row_data, const uint8_t *src,
+	const image_t *img, uint16_t bpp, uint8_t fill, swizzle_fn swizzle)
+{
+	uint32_t len = ((uint32_t) img->width * bpp + 7u) / 8u;
+
+	/* Clear the rest of the row */
+	memset(row_data + len, 0, SIZE_ROW(img->width, bpp) - len);
+
+	switch (bpp) {
+	case 1:
+		pack_1bpp(row_data, src, img->width, img->colors, fill);
+		break;
+	case 4:
+		pack_4bpp(row_data, src, img->width, img->colors, fill);
+		break;
+	case 8:
+		memcpy(row_data, src, img->width);
+		break;
+	case 32:
+		memcpy(row_data, src, img->width * 4u);
+		break;
+	default:
+		/* BMP uses BGR color model */
+		if (img->format == IMG_BGR)
+			memcpy(row_data, src, img->width * 3u);
+		else
+			swizzle(row_data, src, img->width);
+		break;
+	}
+}
+
+/* Largest size of all headers together (color table is bigger than
+   the masks of BITMAPV4HEADER) */
+#define SIZE_HEADERS_MAX	(SIZE_BMP_HEADER + SIZE_DIB_HEADER \
+				+ SIZE_COLOR_TABLE(8))
+
+/* Fill BMP header, DIB header and color table into buf, returns their size
+   (0 if image does not fit into BMP) */
+static size_t set_headers(uint8_t *buf, const image_t *p_img, int top_down)
 {
 	struct BMP_header bmp;
 	struct DIB_header dip;
+	struct DIB_v4_header v4;
+	struct BMP_ct table[256];
+	uint16_t bpp = get_bpp(p_img);
+
+	if (get_bmp_size(p_img) > UINT32_MAX) {
+		fprintf(stderr, "BMP: image too big\n");
+		return 0;
+	}
+
+	set_bmp_header(&bmp, p_img);
+	memcpy(buf, &bmp, SIZE_BMP_HEADER);
+	set_dip_header(&dip, p_img, top_down);
+	memcpy(buf + SIZE_BMP_HEADER, &dip, SIZE_DIB_HEADER);
+	if (bpp == 32) {
+		set_dib_v4_header(&v4);
+		memcpy(buf + SIZE_BMP_HEADER + SIZE_DIB_HEADER, &v4,
+			SIZE_DIB_V4_HEADER);
+	}
+
+	/* Color Table - if present */
+	if (SIZE_COLOR_TABLE(bpp)) {
+		set_color_table(table, p_img);
+		memcpy(buf + SIZE_BMP_HEADER + SIZE_DIB(bpp), table,
+			SIZE_COLOR_TABLE(bpp));
+	}
+
+	return SIZE_BMP_HEADER + SIZE_DIB(bpp) + SIZE_COLOR_TABLE(bpp);
+}
+
+/* Write BMP header, DIB header and color table */
+static size_t write_headers(const image_t *p_img, bmp_write_fn write,
+	void *opaque, int top_down)
+{
+	uint8_t buf[SIZE_HEADERS_MAX];
+	size_t len;
+
+	if ((len = set_headers(buf, p_img, top_down)) == 0)
+		return 0;
+
+	if (write(opaque, buf, len)) {
+		fprintf(stderr, "Write error\n");
+		return 0;
+	}
+
+	return len;
+}
+
+/* Write callback of stdio stream */
+static int file_write(void *opaque, const void *data, size_t len)
+{
+	return fwrite(data, 1, len, (FILE *) opaque) != len;
+}
+
+/* Write headers and rows (bottom-up) one by one */
+static size_t write_rows(const image_t *p_img, bmp_write_fn write,
+	void *opaque, const mem_alloc_t *alloc, swizzle_fn swizzle)
+{
 	size_t bmp_len = 0;
 	size_t ret = 0;
-	size_t cnt;
 	uint16_t rows;
+	uint16_t bpp = get_bpp(p_img);
+	uint8_t fill = get_fill(p_img, bpp);
+	uint32_t row_size = SIZE_ROW(p_img->width, bpp);
+	uint32_t src_size = IMG_ROW_SIZE(p_img->format, p_img->width);
 	uint8_t *row_data = NULL;
+	const uint8_t *src;
 
-	row_data = (uint8_t *) malloc(
-		SIZE_ROW_PADDING(p_img->width * 3) * sizeof(uint8_t));
+	row_data = (uint8_t *) mem_malloc(alloc, row_size * sizeof(uint8_t));
 	if (row_data == NULL) {
 		fprintf(stderr, "Not enough memory\n");
 		goto bmp_err;
 	}
 
-	/* Fill and write BMP header */
-	set_bmp_header(&bmp, p_img);
-	cnt = fwrite(&bmp, 1, SIZE_BMP_HEADER, f_bmp);
-	if (cnt != SIZE_BMP_HEADER) {
-		fprintf(stderr, "Write error\n");
-		goto bmp_err;
-	}
-	bmp_len += cnt;
-
-	/* Fill and write DIP header */
-	set_dip_header(&dip, p_img);
-	cnt = fwrite(&dip, 1, SIZE_DIB_HEADER, f_bmp);
-	if (cnt != SIZE_DIB_HEADER) {
-		fprintf(stderr, "Write error\n");
+	if ((bmp_len = write_headers(p_img, write, opaque, 0)) == 0)
 		goto bmp_err;
-	}
-	bmp_len += cnt;
 
 	/* Start storing rows upside-down */
 	for (rows = p_img->height - 1; rows < p_img->height; rows--) {
-		/* BMP uses BGR color model */
-		for (int i = 0; i < p_img->width; i++) {
-			/* Blue */
-			row_data[i * 3 + 0] = p_img->data[
-				rows * (p_img->width * 3) + i * 3 + 2];
-			/* Green */
-			row_data[i * 3 + 1] = p_img->data[
-				rows * (p_img->width  * 3) + i * 3 + 1];
-			/* Red */
-			row_data[i * 3 + 2] = p_img->data[
-				rows * (p_img->width  * 3) + i * 3 + 0];
+		src = p_img->data + (size_t) rows * src_size;
+
+		/* BGR and BGRA rows are stored exactly as BMP wants them */
+		if (p_img->format != IMG_BGR && p_img->format != IMG_BGRA) {
+			pack_row(row_data, src, p_img, bpp, fill, swizzle);
+			src = row_data;
 		}
-		/* Clear the rest of the row */
-		memset(row_data + p_img->width * 3, 0,
-			SIZE_ROW_PADDING(p_img->width * 3) - p_img->width * 3);
 
 		/* Write row */
-		cnt = fwrite(row_data, 1, SIZE_ROW_PADDING(p_img->width * 3),
-			f_bmp);
-		if (cnt != SIZE_ROW_PADDING(p_img->width * 3)) {
+		if (write(opaque, src, row_size)) {
 			fprintf(stderr, "Write error\n");
 			goto bmp_err;
 		}
-		bmp_len += cnt;
+		bmp_len += row_size;
 	}
 
 	ret = bmp_len;
 bmp_err:
-	free(row_data);
+	mem_free(alloc, row_data);
 
 	return ret;
 }
 
+/* Band of rows converted by one thread straight into BMP in memory */
+typedef struct
+{
+	const image_t *img;
+	uint8_t *pixels;	/* Pixel array of BMP (last image row first) */
+	uint16_t bpp;
+	uint8_t fill;		/* Entry of out of range indices */
+	uint16_t first;		/* Image rows first..last-1 */
+	uint16_t last;
+	swizzle_fn swizzle;
+} band_t;
+
+static void *band_convert(void *arg)
+{
+	const band_t *band = (const band_t *) arg;
+	const image_t *img = band->img;
+	uint32_t row_size = SIZE_ROW(img->width, band->bpp);
+	uint32_t src_size = IMG_ROW_SIZE(img->format, img->width);
+
+	for (uint16_t y = band->first; y < band->last; y++)
+		pack_row(band->pixels + (size_t) (img->height - 1 - y) * row_size,
+			img->data + (size_t) y * src_size, img, band->bpp,
+			band->fill, band->swizzle);
+
+	return NULL;
+}
+
+/* Pixels are converted by up to threads threads, each of them taking band
+   of at least BAND_MIN_SIZE bytes */
+#define BAND_MIN_SIZE	(1u << 20)
+#define BAND_MAX	64
+
+static unsigned bands_count(const image_t *p_img, unsigned threads)
+{
+	uint16_t bpp = get_bpp(p_img);
+	uint64_t n = (uint64_t) SIZE_ROW(p_img->width, bpp) * p_img->height
+		/ BAND_MIN_SIZE;
+
+	if (n > threads)
+		n = threads;
+	if (n > BAND_MAX)
+		n = BAND_MAX;
+	if (n > p_img->height)
+		n = p_img->height;
+
+	return (n) ? n : 1;
+}
+
+/* Fill the whole BMP into buf (of get_bmp_size() bytes) */
+static size_t fill_bmp(const image_t *p_img, uint8_t *buf, unsigned threads,
+	swizzle_fn swizzle)
+{
+	band_t bands[BAND_MAX];
+	pthread_t thread[BAND_MAX];
+	int started[BAND_MAX];
+	unsigned n = bands_count(p_img, threads);
+	uint16_t bpp = get_bpp(p_img);
+	uint8_t fill = get_fill(p_img, bpp);
+	size_t len;
+
+	if ((len = set_headers(buf, p_img, 0)) == 0)
+		return 0;
+
+	for (unsigned i = 0; i < n; i++) {
+		bands[i].img = p_img;
+		bands[i].pixels = buf + len;
+		bands[i].bpp = bpp;
+		bands[i].fill = fill;
+		bands[i].first = (uint32_t) p_img->height * i / n;
+		bands[i].last = (uint32_t) p_img->height * (i + 1) / n;
+		bands[i].swizzle = swizzle;
+	}
+
+	/* The first band is converted by calling thread, as are bands of
+	   threads which failed to start */
+	for (unsigned i = 1; i < n; i++)
+		started[i] = pthread_create(&thread[i], NULL, band_convert,
+			&bands[i]) == 0;
+	band_convert(&bands[0]);
+	for (unsigned i = 1; i < n; i++) {
+		if (started[i])
+			pthread_join(thread[i], NULL);
+		else
+			band_convert(&bands[i]);
+	}
+
+	return get_bmp_size(p_img);
+}
+
+/* Write whole BMP into f_bmp through shared mapping. Returns size of BMP,
+   0 on error, or (size_t) -1 if f_bmp is not empty regular file opened for
+   reading too (or image is too small to be split) - it has to be written by
+   stdio */
+static size_t save_map(const image_t *p_img, FILE *f_bmp, unsigned threads,
+	swizzle_fn swizzle)
+{
+	uint64_t size = get_bmp_size(p_img);
+	uint8_t *map;
+	int fd = fileno(f_bmp);
+	int flags;
+	struct stat st;
+
+	/* Faulting in pages of fresh mapping costs more than write(), it only
+	   pays off when rows are converted by several threads */
+	if (bands_count(p_img, threads) < 2)
+		return (size_t) -1;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size != 0
+		|| ftello(f_bmp) != 0 || size > UINT32_MAX)
+		return (size_t) -1;
+	if ((flags = fcntl(fd, F_GETFL)) < 0 || (flags & O_ACCMODE) != O_RDWR)
+		return (size_t) -1;
+
+	/* Allocate blocks now - running out of space on a mapped page
+	   would be SIGBUS instead of an error */
+	if ((errno = posix_fallocate(fd, 0, size))) {
+		fprintf(stderr, "Write error: %s\n", strerror(errno));
+		return 0;
+	}
+
+	map = (uint8_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+	if (map == MAP_FAILED) {
+		if (ftruncate(fd, 0))
+			return 0;
+		return (size_t) -1;
+	}
+
+	fill_bmp(p_img, map, threads, swizzle);
+
+	if (munmap(map, size) || fseeko(f_bmp, size, SEEK_SET)) {
+		fprintf(stderr, "Write error\n");
+		return 0;
+	}
+
+	return size;
+}
+
+/* Row buffer is held together with whatever decoder keeps */
+static void stats_alloc(stats_t *stats, uint32_t row_size)
+{
+	if (stats->peak_alloc < stats->alloc + row_size)
+		stats->peak_alloc = stats->alloc + row_size;
+}
+
+size_t bmp_size(const image_t *p_img)
+{
+	uint64_t size = get_bmp_size(p_img);
+
+	return (size > UINT32_MAX) ? 0 : size;
+}
+
+size_t bmp_save(const image_t *p_img, FILE *f_bmp, unsigned threads,
+	const mem_alloc_t *alloc, stats_t *stats)
+{
+	swizzle_fn swizzle = swizzle_select();
+	stats_time_t mark;
+	size_t ret;
+
+	if (stats)
+		stats_start(&mark);
+
+	/* Regular files are mapped and filled in by several threads at once */
+	if ((ret = save_map(p_img, f_bmp, threads, swizzle)) == (size_t) -1) {
+		ret = write_rows(p_img, file_write, f_bmp, alloc, swizzle);
+		if (stats)
+			stats_alloc(stats, SIZE_ROW(p_img->width,
+				get_bpp(p_img)));
+	}
+
+	if (stats)
+		stats_stop(&mark, &stats->bmp);
+
+	return ret;
+}
+
+size_t bmp_save_cb(const image_t *p_img, bmp_write_fn write, void *opaque,
+	const mem_alloc_t *alloc, stats_t *stats)
+{
+	stats_time_t mark;
+	size_t ret;
+
+	if (stats)
+		stats_start(&mark);
+
+	ret = write_rows(p_img, write, opaque, alloc, swizzle_select());
+
+	if (stats) {
+		stats_stop(&mark, &stats->bmp);
+		stats_alloc(stats, SIZE_ROW(p_img->width, get_bpp(p_img)));
+	}
+
+	return ret;
+}
+
+size_t bmp_save_mem(const image_t *p_img, uint8_t *buf, size_t size,
+	unsigned threads, stats_t *stats)
+{
+	stats_time_t mark;
+	size_t ret;
+
+	if (bmp_size(p_img) == 0) {
+		fprintf(stderr, "BMP: image too big\n");
+		return 0;
+	}
+	if (size < bmp_size(p_img)) {
+		fprintf(stderr, "BMP: buffer too small\n");
+		return 0;
+	}
+
+	if (stats)
+		stats_start(&mark);
+
+	ret = fill_bmp(p_img, buf, threads, swizzle_select());
+
+	if (stats)
+		stats_stop(&mark, &stats->bmp);
+
+	return ret;
+}
+
+void bmp_stream_open(bmp_stream_t *s, FILE *f_bmp, const mem_alloc_t *alloc,
+	stats_t *stats)
+{
+	assert(f_bmp);
+
+	bmp_stream_open_cb(s, file_write, f_bmp, alloc, stats);
+}
+
+void bmp_stream_open_cb(bmp_stream_t *s, bmp_write_fn write, void *opaque,
+	const mem_alloc_t *alloc, stats_t *stats)
+{
+	assert(s);
+	assert(write);
+
+	s->write = write;
+	s->opaque = opaque;
+	s->alloc = alloc;
+	s->row_data = NULL;
+	s->rows = 0;
+	s->fill = 0;
+	s->len = 0;
+	s->err = 0;
+	s->swizzle = swizzle_select();
+	s->stats = stats;
+}
+
+int bmp_stream_row(void *opaque, const image_t *img, uint16_t y,
+	const uint8_t *row)
+{
+	bmp_stream_t *s = (bmp_stream_t *) opaque;
+	uint16_t bpp = get_bpp(img);
+	uint32_t row_size = SIZE_ROW(img->width, bpp);
+	stats_time_t mark;
+
+	if (s->err || y != s->rows) {
+		s->err = 1;
+		return 1;
+	}
+
+	if (s->stats)
+		stats_start(&mark);
+
+	/* Headers go out together with the first row */
+	if (s->rows == 0) {
+		if ((s->len = write_headers(img, s->write, s->opaque, 1)) == 0)
+			goto bmp_err;
+		s->fill = get_fill(img, bpp);
+
+		s->row_data = (uint8_t *) mem_malloc(s->alloc,
+			row_size * sizeof(uint8_t));
+		if (s->row_data == NULL) {
+			fprintf(stderr, "Not enough memory\n");
+			goto bmp_err;
+		}
+		if (s->stats)
+			stats_alloc(s->stats, row_size);
+	}
+
+	/* 32bpp row needs neither padding nor swizzling */
+	if (bpp != 32) {
+		pack_row(s->row_data, row, img, bpp, s->fill, s->swizzle);
+		row = s->row_data;
+	}
+	if (s->write(s->opaque, row, row_size)) {
+		fprintf(stderr, "Write error\n");
+		goto bmp_err;
+	}
+	s->len += row_size;
+	s->rows++;
+
+	if (s->stats)
+		stats_stop(&mark, &s->stats->bmp);
+
+	return 0;
+
+bmp_err:
+	s->err = 1;
+	return 1;
+}
+
+size_t bmp_stream_close(bmp_stream_t *s, const image_t *img)
+{
+	size_t ret = 0;
+
+	mem_free(s->alloc, s->row_data);
+	s->row_data = NULL;
+
+	/* Image without any row still needs its headers */
+	if (!s->err && img->height == 0)
+		s->len = write_headers(img, s->write, s->opaque, 1);
+
+	if (!s->err && s->rows == img->height)
+		ret = s->len;
+
+	return ret;
+}
@@ -11,9 +11,59 @@
 #ifndef BMP_H
 #define BMP_H
 
-#include "gif2bmp.h"
+#include "image.h"
+#include "swizzle.h"
+#include "stats.h"
+#include "alloc.h"
 
-extern size_t bmp_save(const image_t *p_img, FILE *f_bmp);
+/* Write callback - gets the next len bytes of BMP, returns non-zero on error */
+typedef int (*bmp_write_fn)(void *opaque, const void *data, size_t len);
+
+/* Streaming writer - rows are written top-down as they come */
+typedef struct
+{
+	bmp_write_fn write;
+	void *opaque;		/* Passed to write */
+	const mem_alloc_t *alloc;
+	uint8_t *row_data;
+	uint16_t rows;		/* Number of rows written */
+	uint8_t fill;		/* Entry of out of range indices */
+	size_t len;		/* Number of bytes written */
+	int err;
+	swizzle_fn swizzle;	/* RGB to BGR kernel for running CPU */
+	stats_t *stats;
+} bmp_stream_t;
+
+/* Indexed images are written with the smallest depth (1, 4 or 8 bpp) which
+   holds img->colors entries. Indices at or above img->colors are drawn black,
+   as on RGB canvas, by entries past img->colors - except in 1 and 4 bpp BMP
+   of full color table (2 or 16 colors), which has no such entry: they get
+   the darkest entry of the table there, black only if the table has it.
+
+   Time of writing is added to stats (if not NULL). Empty regular file opened
+   for both reading and writing ("w+b") is sized up front, mapped and its rows
+   are converted by up to threads threads, anything else is written by stdio
+   (row buffer taken from alloc) */
+extern size_t bmp_save(const image_t *p_img, FILE *f_bmp, unsigned threads,
+	const mem_alloc_t *alloc, stats_t *stats);
+/* Write BMP by write, one row at a time (row buffer taken from alloc) */
+extern size_t bmp_save_cb(const image_t *p_img, bmp_write_fn write,
+	void *opaque, const mem_alloc_t *alloc, stats_t *stats);
+/* Write BMP into caller's buffer of size bytes - at least bmp_size() */
+extern size_t bmp_save_mem(const image_t *p_img, uint8_t *buf, size_t size,
+	unsigned threads, stats_t *stats);
+/* Size of BMP file of p_img (bottom-up), 0 if the image does not fit */
+extern size_t bmp_size(const image_t *p_img);
+
+extern void bmp_stream_open(bmp_stream_t *s, FILE *f_bmp,
+	const mem_alloc_t *alloc, stats_t *stats);
+extern void bmp_stream_open_cb(bmp_stream_t *s, bmp_write_fn write,
+	void *opaque, const mem_alloc_t *alloc, stats_t *stats);
+/* Write next row (in img->format) - usable as gif_row_fn with s as opaque */
+extern int bmp_stream_row(void *opaque, const image_t *img, uint16_t y,
+	const uint8_t *row);
+/* Returns size of written BMP, 0 on error or if any row is missing */
+extern size_t bmp_stream_close(bmp_stream_t *s, const image_t *img);
 
 #endif // BMP_H
 
@@ -0,0 +1,101 @@
+/*
+ * crop.c - Cut rectangle out of image row by row as it is decoded
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "crop.h"
+
+void crop_open(crop_t *c, const img_rect_t *rect, gif_row_fn sink,
+	void *opaque, const mem_alloc_t *alloc)
+{
+	memset(c, 0, sizeof(crop_t));
+	c->rect = *rect;
+	c->sink = sink;
+	c->opaque = opaque;
+	c->alloc = alloc;
+}
+
+/* Size of source is known once its first row comes - clip the rectangle */
+static int crop_init(crop_t *c, const image_t *src)
+{
+	img_rect_t *r = &c->rect;
+	size_t size;
+
+	if (r->left >= src->width || r->top >= src->height) {
+		fprintf(stderr, "Error: crop rectangle lies outside of %ux%u "
+			"image\n", src->width, src->height);
+		return 1;
+	}
+	if (r->width > src->width - r->left)
+		r->width = src->width - r->left;
+	if (r->height > src->height - r->top)
+		r->height = src->height - r->top;
+
+	c->img.width = r->width;
+	c->img.height = r->height;
+	c->img.format = src->format;
+	c->img.colors = src->colors;
+	memcpy(c->img.palette, src->palette, sizeof(c->img.palette));
+
+	if (c->sink)
+		return 0;
+
+	size = (size_t) r->height * IMG_ROW_SIZE(c->img.format, r->width);
+	if ((c->img.data = (uint8_t *) mem_malloc(c->alloc, size)) == NULL) {
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+	c->img.data_size = size;
+
+	return 0;
+}
+
+int crop_row(void *opaque, const image_t *img, uint16_t y,
+	const uint8_t *row)
+{
+	crop_t *c = (crop_t *) opaque;
+	unsigned px = IMG_PIXEL_SIZE(img->format);
+	uint32_t len;
+	uint8_t *dst;
+
+	if (c->err || (y == 0 && crop_init(c, img))) {
+		c->err = 1;
+		return 1;
+	}
+
+	if (y < c->rect.top)
+		return 0;
+
+	row += c->rect.left * px;
+	if (c->sink) {
+		if (c->sink(c->opaque, &c->img, c->rows_out, row)) {
+			c->err = 1;
+			return 1;
+		}
+	}
+	else {
+		len = c->rect.width * px;
+		dst = c->img.data + (size_t) c->rows_out
+			* IMG_ROW_SIZE(c->img.format, c->rect.width);
+		memcpy(dst, row, len);
+		/* BMP row padding is written out as it is */
+		memset(dst + len, 0, IMG_ROW_SIZE(c->img.format,
+			c->rect.width) - len);
+	}
+
+	/* Rows below the rectangle are not decoded at all */
+	return (++c->rows_out == c->rect.height) ? GIF_ROW_DONE : 0;
+}
+
+int crop_close(crop_t *c)
+{
+	return c->err || c->rows_out != c->img.height;
+}
@@ -0,0 +1,42 @@
+/*
+ * crop.h - Cut rectangle out of image row by row as it is decoded
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef CROP_H
+#define CROP_H
+
+#include "image.h"
+#include "gif.h"
+#include "alloc.h"
+
+/* Cropping row sink - rows of the rectangle go to sink, or into img.data if
+   there is no sink, the rest is dropped. Once the last row of the rectangle
+   is done, it ends decoding (GIF_ROW_DONE) */
+typedef struct
+{
+	img_rect_t rect;	/* Clipped to the image by the first row */
+	gif_row_fn sink;	/* Gets cropped rows (in img->format) */
+	void *opaque;		/* Passed to sink */
+	const mem_alloc_t *alloc;
+	image_t img;		/* Cropped image - set by the first row */
+	uint16_t rows_out;	/* Cropped rows done */
+	int err;
+} crop_t;
+
+/* img.data (without sink) is taken from alloc and it has to be freed by it,
+   unless the allocator is an arena */
+extern void crop_open(crop_t *c, const img_rect_t *rect, gif_row_fn sink,
+	void *opaque, const mem_alloc_t *alloc);
+/* Add next source row - usable as gif_row_fn with c as opaque */
+extern int crop_row(void *opaque, const image_t *img, uint16_t y,
+	const uint8_t *row);
+/* Returns non-zero on error or if any row is missing */
+extern int crop_close(crop_t *c);
+
+#endif // CROP_H
@@ -12,6 +12,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "gif.h"
 
@@ -72,10 +73,10 @@ struct GIF_ct
 /* Packed Fields for Graphic Control Extension */
 struct GIF_ext_gcontrol_field
 {
-	uint8_t reserved : 3;
-	uint8_t disposal : 3;
-	uint8_t input_flag : 1;
 	uint8_t transparet_flag : 1;
+	uint8_t input_flag : 1;
+	uint8_t disposal : 3;
+	uint8_t reserved : 3;
 } __attribute__((packed));
 
 /* Graphic Control Extension */
@@ -116,12 +117,145 @@ typedef struct
 	uint16_t start_code;
 } lzw_info_t;
 
-/* LZW table */
+#define TABLE_MAX_WIDTH		(12u)
+
+/* LZW dictionary entry - string is stored as (prefix string, suffix byte) */
+typedef struct
+{
+	uint16_t prefix;	/* Code of the string without its last byte */
+	uint16_t len;		/* String length */
+	uint8_t suffix;		/* Last byte of the string */
+	uint8_t first;		/* First byte of the string */
+} dict_t;
+
+/* Input - the whole GIF held in memory, or window of bytes which another
+   thread reads ahead (wait releases bytes before pos and gives the next
+   window, which may be anywhere) */
+typedef struct
+{
+	const uint8_t *pos;	/* Next unread byte */
+	const uint8_t *end;	/* End of input (read so far) */
+	const uint8_t *buf;	/* Start of the window */
+	gif_wait_fn wait;	/* NULL if the whole input is there */
+	void *opaque;		/* Passed to wait */
+	struct GIF_ct *gct;	/* Global color table is copied here, as its
+				   window gets released - NULL without wait */
+	struct GIF_ct *lct;	/* The same for local color table */
+} gif_in_t;
+
+/* Bit reader - image data sub-blocks read as one continuous bitstream */
+typedef struct
+{
+	uint64_t acc;		/* Bit accumulator, LSB is the next bit */
+	unsigned cnt;		/* Number of valid bits in accumulator */
+	const uint8_t *pos;	/* Current position in data sub-block */
+	const uint8_t *end;	/* End of data sub-block */
+	size_t len;		/* Consumed bytes, including block sizes */
+	unsigned blocks;	/* Number of data sub-blocks */
+	uint16_t term;		/* BLOCK_TERM/BLOCK_ERR once the data ended */
+	gif_in_t *in;
+} bitreader_t;
+
+/* Image (frame) placed on canvas */
+typedef struct
+{
+	uint16_t left;
+	uint16_t top;
+	uint16_t width;
+	uint16_t height;
+	int16_t trans;		/* Transparent color index, -1 if none */
+	uint8_t disposal;	/* What to do with the image once it was shown */
+	uint8_t interlace;	/* Rows are stored in 4 passes */
+} frame_t;
+
+/* Image found by pre-scan of animation - everything needed to decode it on
+   its own and to composite it later */
+typedef struct
+{
+	frame_t frame;
+	const struct GIF_ct *ct;	/* Color table, NULL if none */
+	uint16_t ct_size;
+	const uint8_t *data;	/* LZW minimum code size, then sub-blocks */
+	uint16_t delay;		/* Delay after the image, 1/100 s */
+	int loops;		/* Loop count given before the image, -1 if none */
+	uint32_t decoded;	/* Pixels yielded by LZW data */
+	int done;		/* Indices are waiting in the slot */
+} gif_image_t;
+
+/* Images of animation decoded by frame workers at once - image i goes into
+   slot i % window, which is free once image i - window is composited */
+typedef struct
+{
+	gif_image_t *images;
+	unsigned count;
+	const uint8_t *end;	/* End of GIF stream */
+	uint8_t *slots;		/* Palette indices of images in flight */
+	size_t slot_size;
+	unsigned window;	/* Number of slots */
+	unsigned next;		/* Next image to decode */
+	unsigned drawn;		/* Images composited so far */
+	int abort;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;	/* Image decoded or slot freed */
+} frame_pool_t;
+
+/* Frame worker - decodes whole images with LZW state of its own */
 typedef struct
 {
-	uint16_t row;
-	uint8_t val;
-} table_t;
+	frame_pool_t *pool;
+	struct gif_ctx *ctx;
+	stats_t stats;		/* LZW counters, added up once all is done */
+	pthread_t thread;
+} frame_worker_t;
+
+/* Decoder context - holds the whole LZW state of one running decode */
+struct gif_ctx
+{
+	dict_t dict[1u << TABLE_MAX_WIDTH];
+	struct GIF_ct palette[256];	/* Current color table, zero padded */
+	struct GIF_ct ct_copy[2][256];	/* Global and local color table of
+					   input fed by wait */
+	uint32_t lut[256];	/* The same table as BGRA pixels (IMG_BGRA) */
+	gif_opts_t opts;
+	mem_alloc_t alloc;	/* Caller's allocator, zeroed for libc one */
+	frame_t frame;		/* Image being decoded */
+	frame_t disposed;	/* Previous image - waiting for its disposal */
+	uint8_t first;		/* Image is the first one - canvas under it
+				   holds background (or nothing yet) */
+	uint16_t row_len;	/* Pixels of row drawn by draw_row() - fewer
+				   than frame width in the last row of image
+				   whose data end too early */
+	uint8_t bg_index;	/* Background color index */
+	uint8_t bg_rgb[4];	/* Background color in output pixel order
+				   (alpha 0 for IMG_BGRA) */
+	uint8_t *save;		/* Canvas area saved for disposal method 3 */
+	size_t save_size;
+	uint16_t rows_out;	/* Canvas rows handed to row sink */
+	uint8_t sink_done;	/* Row sink needs no more rows */
+	uint8_t *deint;		/* Interlaced image held for row sink */
+	size_t deint_size;
+	uint8_t preview;	/* Pass 1 of current image goes to preview */
+	stats_time_t sink_time;	/* Spent in row sink during current image */
+	/* Output of LZW - canvas, or row buffer whose rows are composited */
+	uint8_t *out;
+	uint8_t px_size;	/* Bytes per pixel stored in 'out' */
+	uint32_t out_base;	/* Index of the pixel stored at out[0] */
+	uint32_t flush_pos;	/* Pixel index completing the next row */
+	uint32_t img_size;	/* Number of pixels in image */
+	uint8_t *line;		/* Row buffer - indices + canvas row */
+	size_t line_size;
+	gif_image_t *images;	/* Images found by pre-scan */
+	unsigned images_size;
+	uint8_t *slots;		/* Slots of frame pool */
+	size_t slots_size;
+	frame_worker_t *workers;
+	unsigned workers_size;
+	uint32_t img_pos;
+	uint16_t table_size;
+	uint16_t prev;		/* Previous code */
+	uint16_t mask;		/* Mask of the current code width */
+	uint8_t bits;		/* Code width */
+};
 
 #define SIZE_HEADER		(sizeof(struct GIF_header))
 #define SIZE_LSD		(sizeof(struct GIF_lsd))
@@ -135,7 +269,6 @@ typedef struct
 #define BLOCK_ERR		((uint16_t) 0xFFFF)
 
 #define TABLE_TERM		((uint16_t) 0xFFFF)
-#define TABLE_MAX_WIDTH		(12u)
 
 #define COLOR_TABLE_SIZE(size)	(3u * (1u << ((size) + 1u)))
 
@@ -148,20 +281,104 @@ typedef struct
 #define EXT_PLAIN_TXT		((uint8_t) 0x01)
 #define EXT_APP			((uint8_t) 0xFF)
 
+#define CTX_ALLOC(ctx)		(((ctx)->alloc.realloc) ? &(ctx)->alloc : NULL)
+
+#define DISPOSAL_BACKGROUND	(2u)
+#define DISPOSAL_PREVIOUS	(3u)
+
+/* Frame-parallel decoding - at most this many workers, and only for images
+   big enough (on average) to outweigh the hand over between threads */
+#define FRAME_WORKERS_MAX	(32u)
+#define FRAME_MIN_PIXELS	(16384u)
+/* Slots of images decoded ahead (one byte per pixel) take at most this many
+   times the pixels of canvas - less than three RGB canvases */
+#define FRAME_SLOTS_CANVASES	(8u)
+
+/* Stage timing - only if caller asked for statistics */
+#define STATS_START(ctx, mark) \
+	do { \
+		if ((ctx)->opts.stats) \
+			stats_start(&(mark)); \
+	} while (0)
+#define STATS_STOP(ctx, mark, stage) \
+	do { \
+		if ((ctx)->opts.stats) \
+			stats_stop(&(mark), &(ctx)->opts.stats->stage); \
+	} while (0)
+
 #define GIF_ERROR(string) \
 	do { \
-		fprintf(stderr, string); \
+		fputs(string, stderr); \
 		gif_len = 0; \
 		goto gif_err; \
 	} while(0)
 
-static size_t load_header(struct GIF_header *header, FILE *f_gif)
+/* Wait until there are len bytes past pos - bytes before pos are released,
+   so no pointer into them may be kept. Returns 0 if the input ends before
+   (or it is all there already) */
+static int in_wait(gif_in_t *in, size_t len)
+{
+	size_t avail;
+
+	if (in->wait == NULL)
+		return 0;
+
+	in->buf = in->wait(in->opaque, in->pos - in->buf, len, &avail);
+	in->pos = in->buf;
+	in->end = in->buf + avail;
+
+	return avail >= len;
+}
+
+static size_t in_read(gif_in_t *in, void *dst, size_t size)
+{
+	if ((size_t) (in->end - in->pos) < size && !in_wait(in, size))
+		return 0;
+
+	memcpy(dst, in->pos, size);
+	in->pos += size;
+
+	return size;
+}
+
+/* Return pointer to next 'size' bytes of input (without copying them) -
+   valid until the input is waited for again */
+static const uint8_t *in_take(gif_in_t *in, size_t size)
+{
+	const uint8_t *data;
+
+	if ((size_t) (in->end - in->pos) < size && !in_wait(in, size))
+		return NULL;
+	data = in->pos;
+	in->pos += size;
+
+	return data;
+}
+
+/* Skip chain of data sub-blocks including the block terminator - the data
+   are not touched at all. Returns number of bytes skipped, 0 if the input
+   ends before the terminator */
+static size_t in_skip_blocks(gif_in_t *in)
+{
+	size_t cnt = 0;
+	uint8_t len;
+
+	do {
+		if (in_read(in, &len, 1) == 0 || in_take(in, len) == NULL)
+			return 0;
+		cnt += len + 1u;
+	} while (len != BLOCK_TERM);
+
+	return cnt;
+}
+
+static size_t load_header(struct GIF_header *header, gif_in_t *in)
 {
 	assert(header);
-	assert(f_gif);
+	assert(in);
 	size_t cnt;
 
-	cnt = fread(header, 1, SIZE_HEADER, f_gif);
+	cnt = in_read(in, header, SIZE_HEADER);
 	if (cnt != SIZE_HEADER)
 		return 0;
 
@@ -174,203 +391,143 @@ static size_t load_header(struct GIF_header *header, FILE *f_gif)
 	return cnt;
 }
 
-static size_t load_lsd(struct GIF_lsd *lsd, FILE *f_gif)
+static size_t load_lsd(struct GIF_lsd *lsd, gif_in_t *in)
 {
 	assert(lsd);
-	assert(f_gif);
+	assert(in);
 	size_t cnt;
 
-	cnt = fread(lsd, 1, SIZE_LSD, f_gif);
+	cnt = in_read(in, lsd, SIZE_LSD);
 	if (cnt != SIZE_LSD)
 		cnt = 0;
 
 	return cnt;
 }
 
-static size_t load_color_table(struct GIF_ct *table, uint16_t size, FILE *f_gif)
+/* Color table is used in place, unless copy is given (input fed by wait,
+   whose window under the table is reused) */
+static size_t load_color_table(const struct GIF_ct **table, uint16_t size,
+	gif_in_t *in, struct GIF_ct *copy)
 {
 	assert(table);
-	assert(f_gif);
+	assert(in);
 	assert(size % sizeof(struct GIF_ct) == 0);
-	size_t cnt;
 
-	cnt = fread(table, 1, size, f_gif);
-	if (cnt != size)
-		cnt = 0;
+	*table = (const struct GIF_ct *) in_take(in, size);
+	if (*table == NULL)
+		return 0;
 
-	return cnt;
+	if (copy) {
+		memcpy(copy, *table, size);
+		*table = copy;
+	}
+
+	return size;
 }
 
-static size_t load_ext_gcontrol(struct GIF_ext_gcontrol *ext, FILE *f_gif)
+static size_t load_ext_gcontrol(struct GIF_ext_gcontrol *ext, gif_in_t *in)
 {
 	assert(ext);
-	assert(f_gif);
+	assert(in);
 	size_t cnt;
 	uint8_t byte;
 
-	cnt = fread(&byte, 1, 1, f_gif);
+	cnt = in_read(in, &byte, 1);
 	if (cnt != 1 || byte != SIZE_EXT_GCONTROL)
 		return 0;
 
-	cnt = fread(ext, 1, SIZE_EXT_GCONTROL, f_gif);
+	cnt = in_read(in, ext, SIZE_EXT_GCONTROL);
 	if (cnt != SIZE_EXT_GCONTROL)
 		return 0;
 
-	cnt = fread(&byte, 1, 1, f_gif);
+	cnt = in_read(in, &byte, 1);
 	if (cnt != 1 || byte != BLOCK_TERM)
 		return 0;
 
 	return 1 + SIZE_EXT_GCONTROL + 1;
 }
 
-static size_t load_ext_comment(FILE *f_gif)
+/* Plain Text Extension - its header is checked, text is not rendered */
+static size_t load_ext_plain(gif_in_t *in)
 {
-	assert(f_gif);
-	char comment[256];
-	size_t cnt, ret;
-	uint8_t byte;
-
-	/* Read block size */
-	cnt = fread(&byte, 1, 1, f_gif);
-	if (cnt != 1)
-		return 0;
-	ret = 1;
-
-	/* Read all data sub-blocks */
-	while (byte != BLOCK_TERM) {
-		cnt = fread(comment, 1, byte, f_gif);
-		if (cnt != byte)
-			return 0;
-		ret += cnt;
-
-		comment[byte] = '\0';
-		printf("GIF: Comment: '%s'\n", comment);
-
-		/* Read block size */
-		cnt = fread(&byte, 1, 1, f_gif);
-		if (cnt != 1)
-			return 0;
-		ret++;
-	}
-
-	return ret;
-}
-
-static size_t load_ext_plain(struct GIF_ext_plain *ext, FILE *f_gif)
-{
-	assert(ext);
-	assert(f_gif);
-	uint8_t data[256];
-	size_t cnt, ret;
-	uint8_t byte;
-
-	cnt = fread(&byte, 1, 1, f_gif);
-	if (cnt != 1 || byte != SIZE_EXT_PLAIN)
-		return 0;
-	ret = 1;
+	assert(in);
+	const uint8_t *size;
+	size_t cnt;
 
-	cnt = fread(&ext, 1, SIZE_EXT_PLAIN, f_gif);
-	if (cnt != SIZE_EXT_PLAIN)
+	size = in_take(in, 1 + SIZE_EXT_PLAIN);
+	if (size == NULL || *size != SIZE_EXT_PLAIN)
 		return 0;
-	ret += SIZE_EXT_PLAIN;
 
-	cnt = fread(&byte, 1, 1, f_gif);
-	if (cnt != 1 || byte != BLOCK_TERM)
+	if ((cnt = in_skip_blocks(in)) == 0)
 		return 0;
-	ret++;
-
-	/* Read all data sub-blocks */
-	while (byte != BLOCK_TERM) {
-		cnt = fread(data, 1, byte, f_gif);
-		if (cnt != byte)
-			return 0;
-		ret += cnt;
-
-		/* Read block size */
-		cnt = fread(&byte, 1, 1, f_gif);
-		if (cnt != 1)
-			return 0;
-		ret++;
-	}
 
-	return ret;
+	return 1 + SIZE_EXT_PLAIN + cnt;
 }
 
-static size_t load_ext_app(struct GIF_ext_app *ext, FILE *f_gif)
+/* Application Extension - identifier is checked, only loop count of
+   Netscape (or AnimExts) extension is used. Its first sub-block is
+   1, then the count (2 bytes, little endian) */
+static size_t load_ext_app(gif_in_t *in, int *loops)
 {
-	assert(ext);
-	assert(f_gif);
-	uint8_t data[256];
-	size_t cnt, ret;
-	uint8_t byte;
-	char identifier[9];
-
-	cnt = fread(&byte, 1, 1, f_gif);
-	if (cnt != 1 || byte != SIZE_EXT_APP)
-		return 0;
-	ret = 1;
+	assert(in);
+	assert(loops);
+	const struct GIF_ext_app *app;
+	const uint8_t *size;
+	size_t cnt;
+	int netscape;
 
-	cnt = fread(ext, 1, SIZE_EXT_APP, f_gif);
-	if (cnt != SIZE_EXT_APP)
+	size = in_take(in, 1 + SIZE_EXT_APP);
+	if (size == NULL || *size != SIZE_EXT_APP)
 		return 0;
-	ret += SIZE_EXT_APP;
 
-	memcpy(identifier, ext->identifier, 8);
-	identifier[8] = '\0';
-	printf("GIF: Application Identifier: %s\n", identifier);
-
-	/* TODO do-while */
-	cnt = fread(&byte, 1, 1, f_gif);
-	if (cnt != 1 || byte != BLOCK_TERM)
+	/* Identifier is checked before waiting for the sub-block, which may
+	   release it */
+	app = (const struct GIF_ext_app *) (size + 1);
+	netscape = (memcmp(app->identifier, "NETSCAPE", 8) == 0
+		&& memcmp(app->auth, "2.0", 3) == 0)
+		|| (memcmp(app->identifier, "ANIMEXTS", 8) == 0
+		&& memcmp(app->auth, "1.0", 3) == 0);
+	if (netscape && (in->end - in->pos >= 4 || in_wait(in, 4))
+		&& in->pos[0] == 3 && in->pos[1] == 1)
+		*loops = in->pos[2] | (in->pos[3] << 8);
+
+	if ((cnt = in_skip_blocks(in)) == 0)
 		return 0;
-	ret++;
-
-	/* Read all data sub-blocks */
-	while (byte != BLOCK_TERM) {
-		cnt = fread(data, 1, byte, f_gif);
-		if (cnt != byte)
-			return 0;
-		ret += cnt;
 
-		/* Read block size */
-		cnt = fread(&byte, 1, 1, f_gif);
-		if (cnt != 1)
-			return 0;
-		ret++;
-	}
-
-	return ret;
+	return 1 + SIZE_EXT_APP + cnt;
 }
 
-static size_t load_ext(FILE *f_gif)
+/* Graphic Control Extension (if any) is stored into gcontrol, loop count
+   of animation into loops. Extensions which do not affect the image are
+   skipped without copying their data */
+static size_t load_ext(gif_in_t *in, struct GIF_ext_gcontrol *gcontrol,
+	int *loops)
 {
-	assert(f_gif);
-	struct GIF_ext_gcontrol gcontrol;
-	struct GIF_ext_plain plain;
-	struct GIF_ext_app app;
+	assert(in);
+	assert(gcontrol);
 	size_t cnt;
 	uint8_t byte;
 
 	/* Identify the current extension */
-	cnt = fread(&byte, 1, 1, f_gif);
+	cnt = in_read(in, &byte, 1);
 	if (cnt != 1)
 		return 0;
 
 	switch (byte) {
 	case EXT_GCONTROL:
-		cnt = load_ext_gcontrol(&gcontrol, f_gif);
-		break;
-	case EXT_COMMENT:
-		cnt = load_ext_comment(f_gif);
+		cnt = load_ext_gcontrol(gcontrol, in);
 		break;
 	case EXT_PLAIN_TXT:
-		cnt = load_ext_plain(&plain, f_gif);
+		cnt = load_ext_plain(in);
 		break;
 	case EXT_APP:
-		cnt = load_ext_app(&app, f_gif);
+		cnt = load_ext_app(in, loops);
 		break;
+	/* Comments and unknown extensions consist of sub-blocks only */
+	case EXT_COMMENT:
 	default:
-		return 0;
+		cnt = in_skip_blocks(in);
+		break;
 	}
 
 	if (cnt == 0)
@@ -379,389 +536,1503 @@ static size_t load_ext(FILE *f_gif)
 	return cnt + 1; /* extension identifier + extension itself */
 }
 
-static size_t load_img_desc(struct GIF_img_desc *desc, FILE *f_gif)
+static size_t load_img_desc(struct GIF_img_desc *desc, gif_in_t *in)
 {
 	assert(desc);
-	assert(f_gif);
+	assert(in);
 	size_t cnt;
 
-	cnt = fread(desc, 1, SIZE_IMG_DESC, f_gif);
+	cnt = in_read(in, desc, SIZE_IMG_DESC);
 	if (cnt != SIZE_IMG_DESC)
 		return 0;
 
 	return cnt;
 }
 
-static size_t read_block(uint8_t *block, FILE *f_gif)
+/* Point 'block' to the next data sub-block - data stay in the input */
+static size_t read_block(const uint8_t **block, gif_in_t *in)
 {
 	size_t cnt;
 	uint8_t len;
 
 	/* Get the block length */
-	cnt = fread(&len, 1, 1, f_gif);
+	cnt = in_read(in, &len, 1);
 	if (cnt != 1)
 		return BLOCK_ERR;
 
 	if (len == BLOCK_TERM)
 		return BLOCK_TERM;
 
-	cnt = fread(block, 1, len, f_gif);
-	if (cnt != len)
+	if ((*block = in_take(in, len)) == NULL)
 		return BLOCK_ERR;
 
-	return cnt;
+	return len;
 }
 
-uint16_t dict_get_row_len(table_t *table, uint16_t row)
+static void br_init(bitreader_t *br, gif_in_t *in)
 {
-	uint16_t len = 1;
-
-	while (table[row].row != TABLE_TERM) {
-		row = table[row].row;
-		len++;
-	}
-
-	return len;
+	br->acc = 0;
+	br->cnt = 0;
+	br->pos = br->end = NULL;
+	br->len = 0;
+	br->blocks = 0;
+	br->term = BLOCK_EMPTY;
+	br->in = in;
 }
 
-static uint16_t dict_get_val(table_t *table, uint16_t row, uint16_t index)
+/* Load next data sub-block; returns 0 once the block terminator is hit */
+static int br_next_block(bitreader_t *br)
 {
-	uint16_t len = dict_get_row_len(table, row);
-	uint16_t pos = 0;
-	uint8_t val = 0;
+	const uint8_t *block = NULL;
+	uint16_t block_len;
+
+	if (br->term != BLOCK_EMPTY)
+		return 0;
 
-	/* Get val from row[index] */
-	while (pos < len - index) {
-		val = table[row].val;
-		row = table[row].row;
-		pos += 1;
+	block_len = read_block(&block, br->in);
+	if (block_len == BLOCK_ERR || block_len == BLOCK_TERM) {
+		br->len += (block_len == BLOCK_TERM);
+		br->term = block_len;
+		return 0;
 	}
+	br->len += block_len + 1;
+	br->blocks++;
+	br->pos = block;
+	br->end = block + block_len;
 
-	return val;
+	return 1;
 }
 
-static uint16_t unpack_code(uint16_t block_len, uint16_t *block_inx,
-	uint8_t *block, uint8_t *shift, uint8_t width, uint32_t *prev_stream,
-	uint8_t *prev_cnt)
+/* Top up accumulator to at least 56 bits (if there is enough data).
+   Sub-block boundaries are handled here only, so reading of a code does not
+   care about them at all */
+static void br_refill(bitreader_t *br)
 {
-	static int clear = 1;	/* Indicator whether we needs data from previous
-				   data block or not */
-	uint32_t stream;	/* Current 4B of streamu */
-	uint16_t code;		/* Loaded code */
-	uint8_t b1, b2, b3, b4;	/* Bytes forming "stream" variable */
-	uint16_t mask = ((uint16_t) 0xFFFF) >> (16 - width);
-	uint16_t stream_req = *shift + width;	/* Required number of valid
-						   bits in data stream */
-
-	/* Completely whole block has been read*/
-	if (*block_inx == block_len) {
-		return BLOCK_EMPTY;
-	}
-
-	/* Join current byte with 3 upcomming bytes (if they are available)
-	   into 32b long stream from which we will mask code of required
-	   width */
-	b1 = block[*block_inx];
-	b2 = (*block_inx + 1 < block_len) ?
-		block[*block_inx + 1] : (uint8_t) 0x00;
-	b3 = (*block_inx + 2 < block_len) ?
-		block[*block_inx + 2] : (uint8_t) 0x00;
-	b4 = (*block_inx + 3 < block_len) ?
-		block[*block_inx + 3] : (uint8_t) 0x00;
-	stream = (((uint32_t) b1) << 0) |
-		(((uint32_t) b2) << 8) |
-		(((uint32_t) b3) << 16) |
-		(((uint32_t) b4) << 24);
+	uint64_t word;
 
-	/* Do we have enough bits? */
-	if (stream_req > (block_len - *block_inx) * 8) {
-		/* Store some data for upcoming data block */
-		*prev_stream = stream;
-		*prev_cnt = block_len - *block_inx;
-		clear = 0;
-		return BLOCK_EMPTY;
-	}
-
-	/* Join current stream with code from previous block if necessary */
-	if (!clear) {
-		if (*prev_cnt == 2) {
-			stream = stream << 16;
-			*prev_stream = *prev_stream & 0xFFFF;
-			*block_inx = -2;
+	while (br->cnt < 56) {
+		if (br->pos == br->end) {
+			if (!br_next_block(br))
+				return;
+		}
+		/* Fast path - load 8 bytes at once. Bits above 'cnt' are the
+		   very same bytes the next refill loads again, so or-ing them
+		   twice does not harm */
+		else if (br->end - br->pos >= 8) {
+			memcpy(&word, br->pos, 8);
+			br->acc |= word << br->cnt;
+			br->pos += (63 - br->cnt) >> 3;
+			br->cnt |= 56;
 		}
 		else {
-			stream = stream << 8;
-			*prev_stream = *prev_stream & 0xFF;
-			*block_inx = -1;
+			br->acc |= (uint64_t) *br->pos++ << br->cnt;
+			br->cnt += 8;
 		}
-		stream = stream | *prev_stream;
 	}
+}
 
-	/* Get code from stream */
-	code = stream >> *shift;
-	code = code & mask;
-
-	*shift += width;
+/* Get code of given width, BLOCK_EMPTY if the data run out */
+static inline uint16_t br_get(bitreader_t *br, uint8_t width, uint16_t mask)
+{
+	uint16_t code;
 
-	/* Update shift position and current block index */
-	while (*shift >= 8) {
-		*shift = *shift - 8;
-		*block_inx += 1;
+	if (br->cnt < width) {
+		br_refill(br);
+		if (br->cnt < width)
+			return BLOCK_EMPTY;
 	}
 
-	clear = 1;
+	code = br->acc & mask;
+	br->acc >>= width;
+	br->cnt -= width;
+
 	return code;
 }
 
-static size_t decompress_data(image_t *img, uint16_t block_len, uint8_t *block,
-	const struct GIF_ct *col_table, const lzw_info_t *lzw_info)
+/* Skip the rest of image data up to the block terminator */
+static void br_drain(bitreader_t *br)
 {
-	/* Static variables */
-	static uint32_t img_pos = 0;
-	static table_t table[1u << TABLE_MAX_WIDTH];
-	static uint16_t table_size = 0;
-	static uint16_t prev = 0xFFFF;	/* Previous code */
-	/* Static variables for fn 'unpack_code' */
-	static uint8_t shift = 0;
-	static uint8_t bits = 0;	/* Code width */
-	static uint32_t prev_stream = 0;
-	static uint8_t prev_cnt = 0;
+	while (br_next_block(br))
+		;
+}
 
-	uint16_t table_size_max;
-	uint16_t data_inx = 0;		/* Pos in data block */
-	uint16_t entry_size;
-	uint16_t code;
-	uint8_t byte;
+static void lzw_reset(gif_ctx_t *ctx, const lzw_info_t *lzw_info)
+{
+	ctx->img_pos = 0;
+	ctx->table_size = lzw_info->start_code;
+	ctx->prev = TABLE_TERM;
+	ctx->bits = lzw_info->min_code + 1;
+	ctx->mask = (1u << ctx->bits) - 1;
+	for (unsigned i = 0; i < lzw_info->clear_code; i++) {
+		ctx->dict[i].prefix = TABLE_TERM;
+		ctx->dict[i].len = 1;
+		ctx->dict[i].suffix = i;
+		ctx->dict[i].first = i;
+	}
+}
 
-	/* Initialization of variables */
-	if (img_pos == 0) {
-		table_size = lzw_info->start_code;
-		bits = lzw_info->min_code + 1;
-		for (unsigned i = 0; i < lzw_info->palette_size; i++) {
-			table[i].row = TABLE_TERM;
-			table[i].val = i;
-		}
+/* Size of frame area which lies within canvas */
+static void frame_clip(const frame_t *f, const image_t *img, uint16_t *width,
+	uint16_t *height)
+{
+	*width = (f->left < img->width) ?
+		((f->width < img->width - f->left) ?
+			f->width : img->width - f->left) : 0;
+	*height = (f->top < img->height) ?
+		((f->height < img->height - f->top) ?
+			f->height : img->height - f->top) : 0;
+}
+
+static void fill_background(const gif_ctx_t *ctx, const image_t *img,
+	uint8_t *dst, uint32_t pixels)
+{
+	if (img->format == IMG_INDEXED)
+		memset(dst, ctx->bg_index, pixels);
+	else if (img->format == IMG_BGRA) {
+		for (uint32_t i = 0; i < pixels; i++)
+			memcpy(dst + i * 4u, ctx->bg_rgb, 4);
+	}
+	else {
+		for (uint32_t i = 0; i < pixels; i++)
+			memcpy(dst + i * 3u, ctx->bg_rgb, 3);
 	}
+}
 
-	/* Current maximum table size */
-	table_size_max = (1 << bits) - 1;
+/* Fill frame area of canvas with background color */
+static void canvas_clear(const gif_ctx_t *ctx, image_t *img, const frame_t *f)
+{
+	unsigned px = IMG_PIXEL_SIZE(img->format);
+	uint16_t width, height;
+
+	frame_clip(f, img, &width, &height);
+	for (uint16_t y = 0; y < height; y++) {
+		fill_background(ctx, img, img->data + (size_t) (f->top + y)
+			* IMG_ROW_SIZE(img->format, img->width)
+			+ f->left * px, width);
+	}
+}
 
-	/* Read code by code from data block */
-	while ((code = unpack_code(block_len, &data_inx, block, &shift,
-		bits, &prev_stream, &prev_cnt)) != BLOCK_EMPTY) {
-		/* Clear Code */
-		if (code == lzw_info->clear_code) {
-			table_size = lzw_info->start_code;
-			bits = lzw_info->min_code + 1;
-			table_size_max = (1 << bits) - 1;
-		}
-		/* End Code */
-		else if (code == lzw_info->end_code) {
-			img_pos = 0;
-			return 1;
-		}
-		/* Always print first word after Clear Code */
-		else if (prev == lzw_info->clear_code) {
-			/* Store pixels */
-			memcpy(img->data + img_pos, &col_table[code], 3);
-			img_pos += 3;
-		}
-		/* Create new entry */
-		else {
-			table[table_size].row = prev;
-			/* Create new entry by entry which is already in
-			   the dictionary */
-			if (code < table_size) {
-				table[table_size].val =
-					dict_get_val(table, code, 0);
-			}
-			/* Create new entry by entry which has been just
-			   created by the compressor */
-			else if (code == table_size) {
-				table[table_size].val =
-					dict_get_val(table, code, 0);
-			}
-			else {
-				fprintf(stderr,
-					"GIF: LZW key not in dictionary\n");
-				return 1;
-			}
-			table_size += 1;
+/* Zero the padding at the end of canvas rows - it is never drawn to */
+static void canvas_pad(image_t *img)
+{
+	uint32_t row_size = IMG_ROW_SIZE(img->format, img->width);
+	uint32_t len = img->width * IMG_PIXEL_SIZE(img->format);
 
-			/* Convert entry into pixels and store them */
-			entry_size = dict_get_row_len(table, code);
-			for (uint16_t i = 0; i < entry_size; i++) {
-				byte = dict_get_val(table, code, i);
-				memcpy(img->data + img_pos,
-					&col_table[byte], 3);
-				img_pos += 3;
-			}
-		}
+	if (row_size == len)
+		return;
 
-		/* Extend table if necessary */
-		if (table_size == table_size_max + 1) {
-			/* Ignoring table overflow is non-standard behaviour
-			   IMHO - but some images are compressed this way
-			   (clear code stored too late) */
-			if (bits < TABLE_MAX_WIDTH)
-				bits++;
-			table_size_max = (1 << bits) - 1;
-		}
+	for (uint16_t y = 0; y < img->height; y++)
+		memset(img->data + (size_t) y * row_size + len, 0,
+			row_size - len);
+}
 
-		prev = code;
+/* Copy frame area of canvas into (or back from) save buffer */
+static int canvas_save(gif_ctx_t *ctx, image_t *img, const frame_t *f,
+	int restore)
+{
+	unsigned px = IMG_PIXEL_SIZE(img->format);
+	uint16_t width, height;
+	size_t size;
+	uint8_t *canvas;
+	uint8_t *save;
+
+	frame_clip(f, img, &width, &height);
+	size = (size_t) width * height * px;
+	if (!restore && ctx->save_size < size) {
+		if ((save = (uint8_t *) mem_realloc(CTX_ALLOC(ctx), ctx->save,
+			size)) == NULL)
+			return 1;
+		ctx->save = save;
+		ctx->save_size = size;
+	}
+
+	for (uint16_t y = 0; y < height; y++) {
+		canvas = img->data + (size_t) (f->top + y)
+			* IMG_ROW_SIZE(img->format, img->width) + f->left * px;
+		save = ctx->save + (size_t) y * width * px;
+		if (restore)
+			memcpy(canvas, save, width * px);
+		else
+			memcpy(save, canvas, width * px);
 	}
 
 	return 0;
 }
 
-static size_t load_image(image_t *img, uint16_t col_table_size,
-	const struct GIF_ct *col_table, FILE *f_gif)
+/* Alloc canvas of the image - from arena, which is reset for every image and
+   sized for canvas and row buffer of BMP writer (at most 4 bytes per pixel,
+   in 32bpp BMP), or caller's buffer is reused
+   if it is big enough. Streamed image does not need any canvas */
+static int canvas_alloc(gif_ctx_t *ctx, image_t *img, size_t size)
 {
-	assert(img);
-	assert(col_table);
-	assert(f_gif);
-	size_t cnt;
-	size_t ret;
-	lzw_info_t lzw_info;
-	uint16_t block_len;
-	uint8_t dict_width;
-	uint8_t block[256];
+	arena_t *arena = ctx->opts.arena;
 
-	/* Read the init key width */
-	cnt = fread(&dict_width, 1, 1, f_gif);
-	if (cnt != 1) {
-		fprintf(stderr, "GIF: LZW error\n");
-		return 0;
+	if (arena) {
+		if (ctx->opts.row_sink)
+			size = 0;
+		if (arena_reset(arena, size + IMG_ROW_SIZE(IMG_BGRA, img->width)
+			+ 2 * ARENA_ALIGN))
+			return 1;
+		img->data = NULL;
+		img->data_size = 0;
+		if (size)
+			img->data = (uint8_t *) arena_alloc(arena, size);
+		return size && img->data == NULL;
 	}
-	ret = cnt;
 
-	lzw_info.min_code = dict_width;
-	lzw_info.palette_size = col_table_size / 3;
-	lzw_info.clear_code = 1 << dict_width;
-	lzw_info.end_code = lzw_info.clear_code + 1;
-	lzw_info.start_code = lzw_info.end_code + 1;
-
-	/* Read and parse image data blocks one by one */
-	while (!((block_len = read_block(block, f_gif)) == BLOCK_ERR
-		|| block_len == BLOCK_TERM)) {
-		ret += block_len + 1;
+	if (ctx->opts.row_sink || img->data_size >= size)
+		return 0;
 
-		/* Parse data block */
-		if (decompress_data(img, block_len, block, col_table, &lzw_info))
-			break;
-	}
+	mem_free(CTX_ALLOC(ctx), img->data);
+	img->data_size = 0;
+	if ((img->data = (uint8_t *) mem_malloc(CTX_ALLOC(ctx), size)) == NULL)
+		return 1;
+	img->data_size = size;
 
-	return (block_len == BLOCK_ERR) ? 0 : ret;
+	return 0;
 }
 
-size_t gif_load(image_t *p_img, FILE *f_gif)
+/* Indexed canvas holds one palette only - convert it to RGB (in place, if
+   it has room) once an image brings a different one */
+static int canvas_promote(gif_ctx_t *ctx, image_t *img)
 {
-	struct GIF_header header;
-	struct GIF_lsd lsd;
-	struct GIF_img_desc img_desc;
-	struct GIF_ct *cct = NULL;	/* current color table */
-	struct GIF_ct *gct = NULL;	/* global color table */
-	struct GIF_ct *lct = NULL;	/* local color table */
-	size_t gif_len = 0;
-	size_t block_len = 0;
-	uint16_t cct_size = 0;		/* current color table size */
-	uint16_t gct_size = 0;		/* global color table size */
-	uint16_t lct_size = 0;		/* local color table size */
-	uint8_t byte;
+	size_t pixels = (size_t) img->width * img->height;
+	uint8_t *data = img->data;
 
-	/* Parse Header */
-	if ((block_len = load_header(&header, f_gif)) == 0)
-		GIF_ERROR("GIF: Invalid header\n");
-	gif_len += block_len;
+	if (ctx->opts.arena) {
+		if ((data = (uint8_t *) arena_alloc(ctx->opts.arena,
+			pixels * 3u)) == NULL)
+			return 1;
+	}
+	else if (img->data_size < pixels * 3u) {
+		if ((data = (uint8_t *) mem_realloc(CTX_ALLOC(ctx), img->data,
+			pixels * 3u)) == NULL)
+			return 1;
+		img->data = data;
+		img->data_size = pixels * 3u;
+	}
 
-	/* Parse Logical Screen Descriptor */
-	if ((block_len = load_lsd(&lsd, f_gif)) == 0)
-		GIF_ERROR("GIF: Invalid Local Screen Descriptor\n");
-	gif_len += block_len;
+	/* Going backwards never overwrites index which is yet to be read */
+	for (size_t i = pixels; i-- > 0;)
+		memcpy(data + i * 3u, img->palette + img->data[i] * 3u, 3);
+	img->data = data;
+	img->format = IMG_RGB;
 
-	/* Parse Global Color Table - if present */
-	if (lsd.field.gct_flag) {
-		if ((gct = (struct GIF_ct *) malloc(
-			COLOR_TABLE_SIZE(lsd.field.gct_size))) == NULL) {
-			GIF_ERROR("Not enough memory\n");
-		}
+	return 0;
+}
 
-		if ((block_len = load_color_table(gct,
-			COLOR_TABLE_SIZE(lsd.field.gct_size), f_gif)) == 0) {
-			GIF_ERROR("GIF: Invalid Global Color Table\n");
+/* Set color table of the image being decoded */
+static int set_palette(gif_ctx_t *ctx, image_t *img,
+	const struct GIF_ct *col_table, uint16_t col_table_size, unsigned frame)
+{
+	/* Indices outside of color table (or missing table) give black */
+	memset(ctx->palette, 0, sizeof(ctx->palette));
+	if (col_table)
+		memcpy(ctx->palette, col_table, col_table_size);
+
+	/* Expand the table into output pixel format once, so LZW emits final
+	   pixels right away */
+	if (img->format == IMG_BGR) {
+		for (unsigned i = 0; i < col_table_size / 3u; i++) {
+			ctx->palette[i].r = col_table[i].b;
+			ctx->palette[i].b = col_table[i].r;
 		}
-		gif_len += block_len;
-		gct_size = COLOR_TABLE_SIZE(lsd.field.gct_size);
 	}
+	else if (img->format == IMG_BGRA) {
+		for (unsigned i = 0; i < 256; i++) {
+			uint8_t px[4] = { ctx->palette[i].b, ctx->palette[i].g,
+				ctx->palette[i].r, 0xFF };
 
-	/* Check label - determine which block follows */
-	if (fread(&byte, 1, 1, f_gif) == 0)
-		GIF_ERROR("GIF: missing file content\n");
-	gif_len++;
-
-	/* Parse Data Streams */
-	do {
-		/* Parse extensions - if present */
-		while (byte == INTRO_EXTENSION) {
-			if ((block_len = load_ext(f_gif)) == 0)
-				GIF_ERROR("GIF: invalid extension\n");
-			gif_len += block_len;
-
-			if (fread(&byte, 1, 1, f_gif) == 0)
-				GIF_ERROR("GIF: missing file content\n");
-			gif_len++;
+			memcpy(&ctx->lut[i], px, 4);
 		}
+	}
 
-		/* Parse Image Descriptor */
-		if (byte != INTRO_IMG_DESC)
-			GIF_ERROR("GIF: missing image description\n");
-		if ((block_len = load_img_desc(&img_desc, f_gif)) == 0)
-			GIF_ERROR("GIF: invalid image descriptor\n");
-		gif_len += block_len;
+	if (img->format != IMG_INDEXED)
+		return 0;
 
-		/* Check if Image and Screen descriptor size differs */
-		if (lsd.width != img_desc.width ||
-			lsd.height != img_desc.height)
-			GIF_ERROR("Image and Screen desc size differs\n");
+	if (frame == 0) {
+		memcpy(img->palette, ctx->palette, sizeof(img->palette));
+		img->colors = (col_table) ? col_table_size / 3u : 2;
+	}
+	else if (memcmp(img->palette, ctx->palette, sizeof(img->palette)))
+		return canvas_promote(ctx, img);
 
-		/* Parse Local Color Table - if present */
-		if (img_desc.field.lct_flag) {
-			if ((lct = (struct GIF_ct *) malloc(
-			COLOR_TABLE_SIZE(img_desc.field.lct_size))) == NULL)
-				GIF_ERROR("Not enough memory\n");
+	return 0;
+}
 
-			if ((block_len = load_color_table(lct,
-			COLOR_TABLE_SIZE(img_desc.field.lct_size), f_gif)) == 0)
-				GIF_ERROR("Invalid Local Color Table\n");
-			gif_len += block_len;
-			lct_size = COLOR_TABLE_SIZE(img_desc.field.lct_size);
+/* Draw row of frame over canvas row - transparent pixels are skipped */
+static void draw_row(const gif_ctx_t *ctx, const image_t *img, uint8_t *dst,
+	const uint8_t *src)
+{
+	const frame_t *f = &ctx->frame;
+	int trans = f->trans;
+	uint16_t width, height;
+
+	frame_clip(f, img, &width, &height);
+	if (width > ctx->row_len)
+		width = ctx->row_len;
+	if (img->format == IMG_INDEXED) {
+		dst += f->left;
+		for (uint16_t x = 0; x < width; x++) {
+			if (src[x] != trans)
+				dst[x] = src[x];
+		}
+	}
+	else if (img->format == IMG_BGRA) {
+		dst += f->left * 4u;
+		for (uint16_t x = 0; x < width; x++) {
+			if (src[x] != trans)
+				memcpy(dst + x * 4u, &ctx->lut[src[x]], 4);
+		}
+	}
+	else {
+		dst += f->left * 3u;
+		for (uint16_t x = 0; x < width; x++) {
+			if (src[x] != trans)
+				memcpy(dst + x * 3u, &ctx->palette[src[x]], 3);
 		}
+	}
+}
 
-		/* Alloc canvas for image */
-		if ((p_img->data =
-		(uint8_t *) malloc(lsd.width * lsd.height * 3u)) == NULL)
-			GIF_ERROR("Not enough memory\n");
-		p_img->width  = lsd.width;
-		p_img->height = lsd.height;
+/* Hand next canvas row to row sink - streamed image is drawn over
+   background, src is NULL for rows which it does not cover */
+static int stream_row(gif_ctx_t *ctx, image_t *img, const uint8_t *src)
+{
+	uint8_t *row = ctx->line + ctx->frame.width + (1u << TABLE_MAX_WIDTH);
+	stats_time_t mark;
+	int ret;
+
+	fill_background(ctx, img, row, img->width);
+	if (src)
+		draw_row(ctx, img, row, src);
+
+	STATS_START(ctx, mark);
+	if ((ret = ctx->opts.row_sink(ctx->opts.opaque, img, ctx->rows_out,
+		row))) {
+		ctx->sink_done = (ret == GIF_ROW_DONE);
+		return 1;
+	}
+	if (ctx->opts.stats)
+		stats_stop(&mark, &ctx->sink_time);
+	ctx->rows_out++;
 
-		/* Choose Current Color Table */
-		cct = (lct) ? lct : gct;
-		cct_size = (lct) ? lct_size : gct_size;
+	return 0;
+}
 
-		/* Parse image data */
-		if ((block_len = load_image(p_img, cct_size, cct, f_gif)) == 0)
-			GIF_ERROR("GIF: Invalid picture data\n");
-		gif_len += block_len;
+/* Stream canvas row 'row' - background rows above it go first */
+static int sink_row(gif_ctx_t *ctx, image_t *img, uint32_t row,
+	const uint8_t *src)
+{
+	while (ctx->rows_out < row) {
+		if (stream_row(ctx, img, NULL))
+			return 1;
+	}
 
-		if (lct) {
-			free(lct);
-			lct = NULL;
-			lct_size = 0;
-		}
+	return stream_row(ctx, img, src);
+}
+
+/* Rows of interlaced image come in 4 passes: every 8th row from row 0,
+   every 8th from 4, every 4th from 2 and every 2nd from 1 */
+static uint32_t interlace_row(uint32_t y, uint16_t height)
+{
+	uint32_t rows;
+
+	if (y < (rows = (height + 7u) / 8u))
+		return y * 8u;
+	y -= rows;
+	if (y < (rows = (height + 3u) / 8u))
+		return y * 8u + 4u;
+	y -= rows;
+	if (y < (rows = (height + 1u) / 4u))
+		return y * 4u + 2u;
+	y -= rows;
+
+	return y * 2u + 1u;
+}
+
+/* Position of row 'fy' of interlaced image in its data - inverse of
+   interlace_row() */
+static uint32_t interlace_index(uint32_t fy, uint16_t height)
+{
+	uint32_t base;
+
+	if (fy % 8u == 0)
+		return fy / 8u;
+	base = (height + 7u) / 8u;
+	if (fy % 8u == 4u)
+		return base + fy / 8u;
+	base += (height + 3u) / 8u;
+	if (fy % 4u == 2u)
+		return base + fy / 4u;
+	base += (height + 1u) / 4u;
+
+	return base + fy / 2u;
+}
+
+/* Preview of interlaced image - pass 1 row is drawn over the 7 rows of the
+   later passes too. Rows with transparency are not replicated, they would
+   leave pixels behind which the later passes do not overwrite */
+static int preview_row(gif_ctx_t *ctx, image_t *img, uint32_t y,
+	uint32_t row, const uint8_t *src)
+{
+	const frame_t *f = &ctx->frame;
+	uint32_t row_size = IMG_ROW_SIZE(img->format, img->width);
+	uint32_t end = f->top + f->height;
+
+	if (f->trans < 0) {
+		if (end > img->height)
+			end = img->height;
+		for (uint32_t r = row + 1; r < row + 8u && r < end; r++)
+			draw_row(ctx, img, img->data + (size_t) r * row_size,
+				src);
+	}
+
+	/* Last row of pass 1 */
+	if (y + 1 == (f->height + 7u) / 8u) {
+		ctx->preview = 0;
+		return ctx->opts.preview_sink(ctx->opts.opaque, img, 0);
+	}
+
+	return 0;
+}
+
+/* Place completed row 'y' of frame onto canvas (or stream it). Interlaced
+   rows go right to their final position */
+static int frame_row(gif_ctx_t *ctx, image_t *img, uint32_t y,
+	const uint8_t *src)
+{
+	uint32_t fy = (ctx->frame.interlace) ?
+		interlace_row(y, ctx->frame.height) : y;
+	uint32_t row = ctx->frame.top + fy;
+
+	if (row >= img->height)
+		return 0;
+
+	if (ctx->opts.row_sink) {
+		/* Sink wants rows top to bottom - keep them till the end */
+		if (ctx->frame.interlace) {
+			memcpy(ctx->deint + (size_t) fy * ctx->frame.width, src,
+				ctx->frame.width);
+			return 0;
+		}
+		return sink_row(ctx, img, row, src);
+	}
+
+	draw_row(ctx, img, img->data + (size_t) row
+		* IMG_ROW_SIZE(img->format, img->width), src);
+
+	if (ctx->preview)
+		return preview_row(ctx, img, y, row, src);
+
+	return 0;
+}
+
+/* Image covering the whole (unpadded) canvas is simply decoded into it */
+static int frame_direct(const gif_ctx_t *ctx, const image_t *img)
+{
+	const frame_t *f = &ctx->frame;
+
+	return ctx->opts.row_sink == NULL && f->trans < 0 && !f->interlace
+		&& f->left == 0
+		&& f->top == 0 && f->width == img->width
+		&& f->height == img->height && IMG_ROW_SIZE(img->format,
+		img->width) == img->width * IMG_PIXEL_SIZE(img->format);
+}
+
+/* Direct LZW output either right into canvas, or into row buffer whose
+   completed rows are composited onto canvas (or streamed) */
+static int lzw_set_output(gif_ctx_t *ctx, image_t *img)
+{
+	const frame_t *f = &ctx->frame;
+	size_t line_size;
+	uint8_t *line;
+
+	ctx->img_size = (uint32_t) f->width * f->height;
+	ctx->out_base = 0;
+
+	if (frame_direct(ctx, img)) {
+		ctx->out = img->data;
+		ctx->px_size = IMG_PIXEL_SIZE(img->format);
+		ctx->flush_pos = UINT32_MAX;
+		return 0;
+	}
+
+	/* Row of indices plus the longest LZW string, then canvas row */
+	line_size = f->width + (1u << TABLE_MAX_WIDTH) + img->width
+		* IMG_PIXEL_SIZE(img->format);
+	if (ctx->line_size < line_size) {
+		if ((line = (uint8_t *) mem_realloc(CTX_ALLOC(ctx), ctx->line,
+			line_size)) == NULL)
+			return 1;
+		ctx->line = line;
+		ctx->line_size = line_size;
+	}
+	ctx->out = ctx->line;
+	ctx->px_size = 1;
+	ctx->flush_pos = (f->width) ? f->width : UINT32_MAX;
+
+	/* Streamed interlaced image is put together first */
+	if (ctx->opts.row_sink && f->interlace
+		&& ctx->deint_size < ctx->img_size) {
+		if ((line = (uint8_t *) mem_realloc(CTX_ALLOC(ctx),
+			ctx->deint, ctx->img_size)) == NULL)
+			return 1;
+		ctx->deint = line;
+		ctx->deint_size = ctx->img_size;
+	}
+
+	return 0;
+}
+
+/* Hand completed rows of row buffer over to canvas */
+static int lzw_flush_rows(gif_ctx_t *ctx, image_t *img)
+{
+	const uint8_t *src = ctx->line;
+	uint16_t width = ctx->frame.width;
+
+	while (ctx->img_pos - ctx->out_base >= width) {
+		if (frame_row(ctx, img, ctx->out_base / width, src))
+			return 1;
+
+		src += width;
+		ctx->out_base += width;
+	}
+
+	/* Move the beginning of next row to the start of row buffer */
+	memmove(ctx->line, src, ctx->img_pos - ctx->out_base);
+	ctx->flush_pos = ctx->out_base + width;
+
+	return 0;
+}
+
+/* Pixels of frame its data do not cover (past 'decoded' ones) are not drawn,
+   canvas keeps there what it has. Only the first image puts background
+   there - canvas under it is not drawn to (or it holds rows replicated by
+   preview) */
+static void canvas_missing(const gif_ctx_t *ctx, image_t *img,
+	uint32_t decoded)
+{
+	const frame_t *f = &ctx->frame;
+	uint32_t row_size = IMG_ROW_SIZE(img->format, img->width);
+	unsigned px = IMG_PIXEL_SIZE(img->format);
+	uint16_t width, height;
+	uint32_t fy, x;
+
+	if (!ctx->first || decoded >= (uint32_t) f->width * f->height)
+		return;
+
+	frame_clip(f, img, &width, &height);
+	for (uint32_t i = decoded / f->width; i < f->height; i++) {
+		fy = (f->interlace) ? interlace_row(i, f->height) : i;
+		x = (i == decoded / f->width) ? decoded % f->width : 0;
+		if (fy < height && x < width)
+			fill_background(ctx, img, img->data + (size_t)
+				(f->top + fy) * row_size + (f->left + x) * px,
+				width - x);
+	}
+}
+
+/* Finish image whose data ended too early - the row decoded in part is
+   drawn up to its last pixel, missing pixels are left out (see
+   canvas_missing()). Streamed canvas is completed by background rows */
+static int lzw_flush_rest(gif_ctx_t *ctx, image_t *img)
+{
+	const frame_t *f = &ctx->frame;
+	uint32_t part = ctx->img_pos - ctx->out_base;
+	uint32_t pos;
+	int ret;
+
+	if (ctx->out != img->data && part) {
+		ctx->row_len = part;
+		ret = frame_row(ctx, img, ctx->out_base / f->width, ctx->line);
+		ctx->row_len = f->width;
+		if (ret)
+			return 1;
+	}
+
+	if (ctx->opts.row_sink == NULL) {
+		canvas_missing(ctx, img, ctx->img_pos);
+		/* Pass 1 has not been completed */
+		if (ctx->preview) {
+			ctx->preview = 0;
+			return ctx->opts.preview_sink(ctx->opts.opaque, img, 0);
+		}
+		return 0;
+	}
+
+	/* Rows which are missing in the data come from the loop below */
+	if (f->interlace) {
+		for (uint32_t y = 0; y < f->height && f->top + y < img->height;
+			y++) {
+			pos = interlace_index(y, f->height) * f->width;
+			if (pos >= ctx->img_pos)
+				continue;
+			ctx->row_len = (ctx->img_pos - pos < f->width) ?
+				ctx->img_pos - pos : f->width;
+			ret = sink_row(ctx, img, f->top + y, ctx->deint
+				+ (size_t) y * f->width);
+			ctx->row_len = f->width;
+			if (ret)
+				return 1;
+		}
+	}
+
+	while (ctx->rows_out < img->height) {
+		if (stream_row(ctx, img, NULL))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Write string of 'code' into output - walking the prefix chain from the
+   last byte towards the first one, so every pixel is touched exactly once.
+   It is a part of every specialized decoding loop */
+static inline __attribute__((always_inline)) void lzw_emit(gif_ctx_t *ctx,
+	uint16_t code)
+{
+	const dict_t *dict = ctx->dict;
+	uint32_t len = dict[code].len;
+	uint8_t *dst;
+
+	/* Drop the pixels which do not fit into canvas (corrupted data) */
+	if (ctx->img_pos + len > ctx->img_size) {
+		for (; len > ctx->img_size - ctx->img_pos; len--)
+			code = dict[code].prefix;
+	}
+
+	ctx->img_pos += len;
+	if (ctx->px_size == 1) {
+		dst = ctx->out + (ctx->img_pos - ctx->out_base);
+		while (len--) {
+			*--dst = dict[code].suffix;
+			code = dict[code].prefix;
+		}
+	}
+	else if (ctx->px_size == 4) {
+		dst = ctx->out + (ctx->img_pos - ctx->out_base) * 4u;
+		while (len--) {
+			dst -= 4;
+			memcpy(dst, &ctx->lut[dict[code].suffix], 4);
+			code = dict[code].prefix;
+		}
+	}
+	else {
+		dst = ctx->out + (ctx->img_pos - ctx->out_base) * 3u;
+		while (len--) {
+			dst -= 3;
+			memcpy(dst, &ctx->palette[dict[code].suffix], 3);
+			code = dict[code].prefix;
+		}
+	}
+}
+
+/* LZW decoding loop, returns non-zero if decoding has been aborted by row
+   sink. It is always inlined with constant min_code into the decoders below,
+   so Clear, End and the first free code are constants too. The state which
+   changes with every code is kept in locals - stores of pixels could alias
+   it in ctx otherwise - and it is written back once the data end */
+static inline __attribute__((always_inline)) size_t lzw_decode(
+	gif_ctx_t *ctx, image_t *img, bitreader_t *br, const unsigned min_code)
+{
+	const uint16_t clear_code = 1u << min_code;
+	const uint16_t end_code = clear_code + 1u;
+	const uint16_t start_code = clear_code + 2u;
+	dict_t *dict = ctx->dict;
+	dict_t *entry;
+	uint16_t code;
+	uint16_t prev = ctx->prev;
+	uint16_t table_size = ctx->table_size;
+	uint8_t bits = ctx->bits;
+	uint16_t mask = ctx->mask;
+	size_t ret = 0;
+	/* Counters for statistics - kept local, so they stay in registers */
+	uint32_t codes = 0;
+	uint32_t clears = 0;
+	uint32_t full = 0;
+
+	/* Read code by code from the data sub-blocks */
+	while ((code = br_get(br, bits, mask)) != BLOCK_EMPTY) {
+		codes++;
+
+		/* Clear Code */
+		if (code == clear_code) {
+			table_size = start_code;
+			bits = min_code + 1;
+			mask = (1u << bits) - 1;
+			prev = TABLE_TERM;
+			clears++;
+			continue;
+		}
+		/* End Code */
+		else if (code == end_code) {
+			break;
+		}
+		else if (code > table_size ||
+			(code == table_size && prev == TABLE_TERM)) {
+			fprintf(stderr, "GIF: LZW key not in dictionary\n");
+			break;
+		}
+		/* Always print first word after Clear Code */
+		else if (prev == TABLE_TERM) {
+			lzw_emit(ctx, code);
+		}
+		/* Create new entry - unless the dictionary is full and the
+		   encoder has deferred the clear code */
+		else if (table_size < (1u << TABLE_MAX_WIDTH)) {
+			entry = &dict[table_size];
+			entry->prefix = prev;
+			entry->len = dict[prev].len + 1;
+			entry->first = dict[prev].first;
+			/* Entry which is already in the dictionary ends with
+			   the first byte of the current string, entry which
+			   has been just created by the compressor (KwKwK)
+			   ends with the first byte of the previous one */
+			entry->suffix = (code < table_size) ?
+				dict[code].first : entry->first;
+			table_size += 1;
+
+			lzw_emit(ctx, code);
+		}
+		else {
+			lzw_emit(ctx, code);
+			full++;
+		}
+
+		/* Hand completed rows to row sink */
+		if (ctx->img_pos >= ctx->flush_pos && lzw_flush_rows(ctx, img)) {
+			ret = 1;
+			break;
+		}
+
+		/* Extend table if necessary - with minimum code size 0 the
+		   first free code is past mask + 1 already */
+		if (table_size >= mask + 1u) {
+			/* Ignoring table overflow is non-standard behaviour
+			   IMHO - but some images are compressed this way
+			   (clear code stored too late) */
+			if (bits < TABLE_MAX_WIDTH) {
+				bits++;
+				mask = (1u << bits) - 1;
+			}
+		}
+
+		prev = code;
+	}
+
+	ctx->prev = prev;
+	ctx->table_size = table_size;
+	ctx->bits = bits;
+	ctx->mask = mask;
+
+	if (ctx->opts.stats) {
+		ctx->opts.stats->codes += codes;
+		ctx->opts.stats->clear_codes += clears;
+		/* Every code but Clear and End Code emits a string */
+		ctx->opts.stats->strings += codes - clears
+			- (code == end_code);
+		ctx->opts.stats->dict_full += full;
+		ctx->opts.stats->pixels += ctx->img_pos;
+	}
+
+	return ret;
+}
+
+typedef size_t (*lzw_decode_fn)(gif_ctx_t *ctx, image_t *img,
+	bitreader_t *br, unsigned min_code);
+
+/* Decoder of one minimum code size (GIF allows 2..8) */
+#define LZW_DECODER(n) \
+static size_t lzw_decode_##n(gif_ctx_t *ctx, image_t *img, bitreader_t *br, \
+	unsigned min_code) \
+{ \
+	(void) min_code; \
+	return lzw_decode(ctx, img, br, n); \
+}
+
+LZW_DECODER(2)
+LZW_DECODER(3)
+LZW_DECODER(4)
+LZW_DECODER(5)
+LZW_DECODER(6)
+LZW_DECODER(7)
+LZW_DECODER(8)
+
+/* Sizes 0 and 1 are out of the standard - the code width grows from the
+   first free code, which is past mask + 1 for size 0 */
+static size_t lzw_decode_any(gif_ctx_t *ctx, image_t *img, bitreader_t *br,
+	unsigned min_code)
+{
+	return lzw_decode(ctx, img, br, min_code);
+}
+
+static const lzw_decode_fn lzw_decoders[9] = {
+	lzw_decode_any, lzw_decode_any, lzw_decode_2, lzw_decode_3,
+	lzw_decode_4, lzw_decode_5, lzw_decode_6, lzw_decode_7, lzw_decode_8,
+};
+
+/* Decode image data by the decoder of its minimum code size. Returns
+   non-zero if decoding has been aborted by row sink */
+static size_t decompress_data(gif_ctx_t *ctx, image_t *img, bitreader_t *br,
+	const lzw_info_t *lzw_info)
+{
+	return lzw_decoders[lzw_info->min_code](ctx, img, br,
+		lzw_info->min_code);
+}
+
+static size_t load_image(gif_ctx_t *ctx, image_t *img, uint16_t col_table_size,
+	gif_in_t *in)
+{
+	assert(ctx);
+	assert(img);
+	assert(in);
+	size_t cnt;
+	lzw_info_t lzw_info;
+	bitreader_t br;
+	uint8_t dict_width;
+
+	/* Read the init key width */
+	cnt = in_read(in, &dict_width, 1);
+	if (cnt != 1 || dict_width > 8) {
+		fprintf(stderr, "GIF: LZW error\n");
+		return 0;
+	}
+
+	lzw_info.min_code = dict_width;
+	lzw_info.palette_size = col_table_size / 3;
+	lzw_info.clear_code = 1 << dict_width;
+	lzw_info.end_code = lzw_info.clear_code + 1;
+	lzw_info.start_code = lzw_info.end_code + 1;
+
+	/* Every image starts with a fresh LZW state */
+	lzw_reset(ctx, &lzw_info);
+
+	if (lzw_set_output(ctx, img)) {
+		fprintf(stderr, "Not enough memory\n");
+		return 0;
+	}
+
+	/* Decode image data, then skip whatever follows the End Code */
+	br_init(&br, in);
+	if (decompress_data(ctx, img, &br, &lzw_info) && !ctx->sink_done)
+		return 0;
+	br_drain(&br);
+	if (ctx->opts.stats)
+		ctx->opts.stats->sub_blocks += br.blocks;
+
+	/* Image has to be complete, even if its data are not - unless row
+	   sink has got all the rows it needs */
+	if (!ctx->sink_done && lzw_flush_rest(ctx, img) && !ctx->sink_done)
+		return 0;
+
+	return (br.term == BLOCK_ERR) ? 0 : cnt + br.len;
+}
+
+/* LZW stage ends - time spent in row sink belongs to the sink's stage */
+static void stats_lzw(gif_ctx_t *ctx, const stats_time_t *mark)
+{
+	stats_t *stats = ctx->opts.stats;
+
+	if (stats == NULL)
+		return;
+
+	stats_stop(mark, &stats->lzw);
+	stats->lzw.wall -= ctx->sink_time.wall;
+	stats->lzw.cpu -= ctx->sink_time.cpu;
+	ctx->sink_time.wall = ctx->sink_time.cpu = 0;
+}
+
+/* Account parsed stream and buffers which stay allocated */
+static void stats_done(gif_ctx_t *ctx, const image_t *img, size_t gif_len,
+	unsigned frames)
+{
+	stats_t *stats = ctx->opts.stats;
+
+	stats->bytes_read += gif_len;
+	stats->frames += frames;
+	stats->alloc = sizeof(gif_ctx_t) + ctx->line_size + ctx->save_size
+		+ ctx->deint_size + ctx->images_size * sizeof(gif_image_t)
+		+ ctx->slots_size + ctx->workers_size * (sizeof(frame_worker_t)
+		+ sizeof(gif_ctx_t)) + ((ctx->opts.arena) ? ctx->opts.arena->size
+		: (ctx->opts.row_sink) ? 0 : img->data_size);
+	if (stats->peak_alloc < stats->alloc)
+		stats->peak_alloc = stats->alloc;
+}
+
+gif_ctx_t *gif_ctx_create(const mem_alloc_t *alloc)
+{
+	gif_ctx_t *ctx;
+
+	if ((ctx = (gif_ctx_t *) mem_malloc(alloc, sizeof(gif_ctx_t))) == NULL)
+		return NULL;
+
+	memset(ctx, 0, sizeof(gif_ctx_t));
+	if (alloc)
+		ctx->alloc = *alloc;
+
+	return ctx;
+}
+
+void gif_ctx_destroy(gif_ctx_t *ctx)
+{
+	mem_alloc_t alloc;
+
+	if (ctx == NULL)
+		return;
+
+	/* Context itself is freed by the allocator it holds */
+	alloc = ctx->alloc;
+	mem_free(CTX_ALLOC(ctx), ctx->line);
+	mem_free(CTX_ALLOC(ctx), ctx->save);
+	mem_free(CTX_ALLOC(ctx), ctx->deint);
+	mem_free(CTX_ALLOC(ctx), ctx->images);
+	mem_free(CTX_ALLOC(ctx), ctx->slots);
+	for (unsigned i = 0; i < ctx->workers_size; i++)
+		gif_ctx_destroy(ctx->workers[i].ctx);
+	mem_free(CTX_ALLOC(ctx), ctx->workers);
+	mem_free((alloc.realloc) ? &alloc : NULL, ctx);
+}
+
+void gif_ctx_set_opts(gif_ctx_t *ctx, const gif_opts_t *opts)
+{
+	assert(ctx);
+	assert(opts);
+
+	ctx->opts = *opts;
+}
+
+/* Parse extensions, Image Descriptor and Local Color Table of the next
+   image, byte is its label (already read). Input is left at image data.
+   Returns number of bytes parsed, 0 on error - err says which one */
+static size_t scan_image(gif_in_t *in, uint8_t byte, const struct GIF_ct *gct,
+	uint16_t gct_size, gif_image_t *image, stats_t *stats, const char **err)
+{
+	struct GIF_ext_gcontrol gcontrol;
+	struct GIF_img_desc img_desc;
+	size_t len = 0;
+	size_t block_len;
+	stats_time_t mark;
+
+	memset(&gcontrol, 0, sizeof(gcontrol));
+	image->loops = -1;
+
+	/* Parse extensions - if present */
+	if (stats)
+		stats_start(&mark);
+	while (byte == INTRO_EXTENSION) {
+		if ((block_len = load_ext(in, &gcontrol, &image->loops)) == 0) {
+			*err = "GIF: invalid extension\n";
+			return 0;
+		}
+		len += block_len;
+
+		if (in_read(in, &byte, 1) == 0) {
+			*err = "GIF: missing file content\n";
+			return 0;
+		}
+		len++;
+	}
+	if (stats) {
+		stats_stop(&mark, &stats->ext);
+		stats_start(&mark);
+	}
+
+	/* Parse Image Descriptor */
+	if (byte != INTRO_IMG_DESC) {
+		*err = "GIF: missing image description\n";
+		return 0;
+	}
+	if ((block_len = load_img_desc(&img_desc, in)) == 0) {
+		*err = "GIF: invalid image descriptor\n";
+		return 0;
+	}
+	len += block_len;
+
+	/* Parse Local Color Table - if present, it replaces the global one */
+	image->ct = gct;
+	image->ct_size = gct_size;
+	if (img_desc.field.lct_flag) {
+		image->ct_size = COLOR_TABLE_SIZE(img_desc.field.lct_size);
+		if ((block_len = load_color_table(&image->ct, image->ct_size,
+			in, in->lct)) == 0) {
+			*err = "Invalid Local Color Table\n";
+			return 0;
+		}
+		len += block_len;
+	}
+	if (stats)
+		stats_stop(&mark, &stats->header);
+
+	image->frame.left = img_desc.left_edge;
+	image->frame.top = img_desc.top_edge;
+	image->frame.width = img_desc.width;
+	image->frame.height = img_desc.height;
+	image->frame.trans = (gcontrol.field.transparet_flag) ?
+		gcontrol.transparent : -1;
+	image->frame.disposal = gcontrol.field.disposal;
+	image->frame.interlace = img_desc.field.interlace_flag;
+	image->delay = gcontrol.delay;
+	image->data = in->pos;
+	image->done = 0;
+
+	return len;
+}
+
+/* Make image the current one - set its palette, dispose of the previous
+   image and save what the image covers if it is to be restored later */
+static int image_begin(gif_ctx_t *ctx, image_t *img, const gif_image_t *image,
+	unsigned frames)
+{
+	ctx->frame = image->frame;
+	ctx->first = (frames == 0);
+	ctx->row_len = ctx->frame.width;
+	ctx->preview = (frames == 0 && ctx->frame.interlace
+		&& ctx->opts.preview_sink && !ctx->opts.row_sink);
+
+	if (ctx->opts.row_sink)
+		return set_palette(ctx, img, image->ct, image->ct_size, frames);
+
+	/* Dispose of the previous image only now, so the last image stays on
+	   canvas - but before the palette may promote indexed canvas to RGB,
+	   as the saved area is in the format the canvas had then. First image
+	   is drawn over background unless it covers the whole canvas */
+	if (frames == 0) {
+		ctx->disposed.left = ctx->disposed.top = 0;
+		ctx->disposed.width = img->width;
+		ctx->disposed.height = img->height;
+		if (ctx->frame.trans >= 0 || ctx->frame.left || ctx->frame.top
+			|| ctx->frame.width < img->width
+			|| ctx->frame.height < img->height)
+			canvas_clear(ctx, img, &ctx->disposed);
+	}
+	else if (ctx->disposed.disposal == DISPOSAL_BACKGROUND)
+		canvas_clear(ctx, img, &ctx->disposed);
+	else if (ctx->disposed.disposal == DISPOSAL_PREVIOUS)
+		canvas_save(ctx, img, &ctx->disposed, 1);
+
+	if (set_palette(ctx, img, image->ct, image->ct_size, frames))
+		return 1;
+
+	return ctx->frame.disposal == DISPOSAL_PREVIOUS
+		&& canvas_save(ctx, img, &ctx->frame, 0);
+}
+
+/* Image is on canvas - hand it to frame sink, it is disposed of once the
+   next image comes */
+static int image_end(gif_ctx_t *ctx, image_t *img, unsigned index)
+{
+	if (ctx->opts.frame_sink && ctx->opts.frame_sink(ctx->opts.opaque,
+		img, index))
+		return 1;
+
+	ctx->disposed = ctx->frame;
+
+	return 0;
+}
+
+/* Decode image data into index buffer of the whole image - pixels past
+   image->decoded are missing in the data, they are left as they are */
+static void image_decode(gif_ctx_t *ctx, gif_image_t *image,
+	const uint8_t *end, uint8_t *pixels)
+{
+	/* The init key width is checked by pre-scan already */
+	gif_in_t in = { .pos = image->data + 1, .end = end };
+	uint8_t dict_width = image->data[0];
+	lzw_info_t lzw_info;
+	bitreader_t br;
+
+	lzw_info.min_code = dict_width;
+	lzw_info.palette_size = image->ct_size / 3;
+	lzw_info.clear_code = 1 << dict_width;
+	lzw_info.end_code = lzw_info.clear_code + 1;
+	lzw_info.start_code = lzw_info.end_code + 1;
+
+	lzw_reset(ctx, &lzw_info);
+	ctx->frame = image->frame;
+	ctx->img_size = (uint32_t) image->frame.width * image->frame.height;
+	ctx->out = pixels;
+	ctx->px_size = 1;
+	ctx->out_base = 0;
+	ctx->flush_pos = UINT32_MAX;
+
+	br_init(&br, &in);
+	decompress_data(ctx, NULL, &br, &lzw_info);
+	br_drain(&br);
+	if (ctx->opts.stats)
+		ctx->opts.stats->sub_blocks += br.blocks;
+
+	image->decoded = ctx->img_pos;
+}
+
+/* Composite image decoded by frame worker onto canvas */
+static int image_draw(gif_ctx_t *ctx, image_t *img, const uint8_t *pixels,
+	uint32_t decoded)
+{
+	const frame_t *f = &ctx->frame;
+	uint32_t pos = 0;
+	int ret;
+
+	/* Rows the data have given - the last one may be given in part */
+	for (uint32_t y = 0; y < f->height && pos < decoded; y++) {
+		ctx->row_len = (decoded - pos < f->width) ? decoded - pos
+			: f->width;
+		ret = frame_row(ctx, img, y, pixels + pos);
+		ctx->row_len = f->width;
+		if (ret)
+			return 1;
+		pos += f->width;
+	}
+	canvas_missing(ctx, img, decoded);
+
+	return 0;
+}
+
+static void *frame_worker(void *arg)
+{
+	frame_worker_t *w = (frame_worker_t *) arg;
+	frame_pool_t *pool = w->pool;
+	unsigned i;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->abort && pool->next < pool->count
+			&& pool->next - pool->drawn >= pool->window)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		if (pool->abort || pool->next == pool->count)
+			break;
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		image_decode(w->ctx, &pool->images[i], pool->end, pool->slots
+			+ (size_t) (i % pool->window) * pool->slot_size);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->images[i].done = 1;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/* Pre-scan of animation - find all images and check structure of the whole
+   stream, image data are skipped. Returns number of images, 0 if the stream
+   is broken (sequential decoder reports the error then), has one image only
+   or its images are too small to be decoded in parallel */
+static unsigned images_scan(gif_ctx_t *ctx, gif_in_t *in, uint8_t byte,
+	const struct GIF_ct *gct, uint16_t gct_size)
+{
+	gif_image_t *images;
+	unsigned count = 0;
+	uint64_t pixels = 0;
+	const char *err;
+	uint8_t dict_width;
+
+	do {
+		if (count == ctx->images_size) {
+			if ((images = (gif_image_t *) mem_realloc(
+				CTX_ALLOC(ctx), ctx->images,
+				(count + 64u) * sizeof(gif_image_t))) == NULL)
+				return 0;
+			ctx->images = images;
+			ctx->images_size = count + 64u;
+		}
+		images = &ctx->images[count++];
+
+		if (scan_image(in, byte, gct, gct_size, images, NULL, &err) == 0
+			|| in_read(in, &dict_width, 1) == 0 || dict_width > 8
+			|| in_skip_blocks(in) == 0)
+			return 0;
+		pixels += (uint32_t) images->frame.width * images->frame.height;
 
 		/* Read empty block */
 		do {
-			if (fread(&byte, 1, 1, f_gif) == 0)
+			if (in_read(in, &byte, 1) == 0)
+				return 0;
+		} while (byte == 0);
+	} while (byte != TRAILER);
+
+	return (count > 1 && pixels / count >= FRAME_MIN_PIXELS) ? count : 0;
+}
+
+/* Frame-parallel decoding - images found by pre-scan are decoded by frame
+   workers, while the calling thread composites them in stream order.
+   Returns non-zero on error (already reported), -1 if slots of two workers
+   do not fit into the budget of FRAME_SLOTS_CANVASES - nothing is decoded
+   then, the images have to be decoded sequentially */
+static int images_load(gif_ctx_t *ctx, image_t *img, unsigned count,
+	const uint8_t *end, unsigned *frames)
+{
+	frame_pool_t pool = { .images = ctx->images, .count = count,
+		.end = end, .slot_size = 0 };
+	frame_worker_t *w;
+	unsigned workers = ctx->opts.threads;
+	unsigned started;
+	size_t budget = FRAME_SLOTS_CANVASES * (size_t) img->width
+		* img->height;
+	stats_time_t mark;
+	void *tmp;
+	int ret = 0;
+
+	/* Every slot holds the biggest image */
+	for (unsigned i = 0; i < count; i++) {
+		if (pool.slot_size < (size_t) ctx->images[i].frame.width
+			* ctx->images[i].frame.height)
+			pool.slot_size = (size_t) ctx->images[i].frame.width
+				* ctx->images[i].frame.height;
+	}
+
+	/* Window has two slots per worker, within the budget */
+	if (workers > count)
+		workers = count;
+	if (workers > FRAME_WORKERS_MAX)
+		workers = FRAME_WORKERS_MAX;
+	if (workers > budget / pool.slot_size / 2u)
+		workers = budget / pool.slot_size / 2u;
+	if (workers < 2)
+		return -1;
+	pool.window = (2u * workers < count) ? 2u * workers : count;
+	if (ctx->slots_size < pool.window * pool.slot_size) {
+		if ((tmp = mem_realloc(CTX_ALLOC(ctx), ctx->slots,
+			pool.window * pool.slot_size)) == NULL)
+			goto images_mem_err;
+		ctx->slots = (uint8_t *) tmp;
+		ctx->slots_size = pool.window * pool.slot_size;
+	}
+	pool.slots = ctx->slots;
+
+	/* Workers are kept in context, each with its own LZW dictionary */
+	if (ctx->workers_size < workers) {
+		if ((tmp = mem_realloc(CTX_ALLOC(ctx), ctx->workers,
+			workers * sizeof(frame_worker_t))) == NULL)
+			goto images_mem_err;
+		ctx->workers = (frame_worker_t *) tmp;
+		for (; ctx->workers_size < workers; ctx->workers_size++) {
+			w = &ctx->workers[ctx->workers_size];
+			if ((w->ctx = gif_ctx_create(CTX_ALLOC(ctx))) == NULL)
+				goto images_mem_err;
+		}
+	}
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+	for (started = 0; started < workers; started++) {
+		w = &ctx->workers[started];
+		w->pool = &pool;
+		memset(&w->stats, 0, sizeof(w->stats));
+		w->ctx->opts.stats = (ctx->opts.stats) ? &w->stats : NULL;
+		if (pthread_create(&w->thread, NULL, frame_worker, w))
+			break;
+	}
+
+	if (started == 0) {
+		fprintf(stderr, "GIF: cannot start frame workers\n");
+		ret = 1;
+	}
+
+	for (unsigned i = 0; i < count && ret == 0; i++) {
+		pthread_mutex_lock(&pool.lock);
+		while (!pool.images[i].done)
+			pthread_cond_wait(&pool.cond, &pool.lock);
+		pthread_mutex_unlock(&pool.lock);
+
+		if (image_begin(ctx, img, &pool.images[i], i)) {
+			fprintf(stderr, "Not enough memory\n");
+			ret = 1;
+			break;
+		}
+		if (image_draw(ctx, img, pool.slots + (size_t) (i % pool.window)
+			* pool.slot_size, pool.images[i].decoded)) {
+			fprintf(stderr, "GIF: Invalid picture data\n");
+			ret = 1;
+			break;
+		}
+		*frames = i + 1;
+
+		/* Frame sink does not belong to LZW stage */
+		STATS_START(ctx, mark);
+		if (image_end(ctx, img, i)) {
+			fprintf(stderr, "GIF: frame output failed\n");
+			ret = 1;
+			break;
+		}
+		if (ctx->opts.stats)
+			stats_stop(&mark, &ctx->sink_time);
+
+		pthread_mutex_lock(&pool.lock);
+		pool.drawn = i + 1;
+		pthread_cond_broadcast(&pool.cond);
+		pthread_mutex_unlock(&pool.lock);
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.abort = 1;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (unsigned i = 0; i < started; i++) {
+		w = &ctx->workers[i];
+		pthread_join(w->thread, NULL);
+		if (ctx->opts.stats) {
+			ctx->opts.stats->sub_blocks += w->stats.sub_blocks;
+			ctx->opts.stats->codes += w->stats.codes;
+			ctx->opts.stats->clear_codes += w->stats.clear_codes;
+			ctx->opts.stats->strings += w->stats.strings;
+			ctx->opts.stats->dict_full += w->stats.dict_full;
+			ctx->opts.stats->pixels += w->stats.pixels;
+		}
+	}
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.lock);
+
+	return ret;
+
+images_mem_err:
+	fprintf(stderr, "Not enough memory\n");
+	return 1;
+}
+
+static size_t load_gif(image_t *p_img, gif_in_t in, gif_ctx_t *ctx)
+{
+	gif_in_t scan;
+	gif_ctx_t *own_ctx = NULL;	/* context created by us */
+	struct GIF_header header;
+	struct GIF_lsd lsd;
+	gif_image_t image;
+	const struct GIF_ct *gct = NULL;	/* global color table */
+	const char *err;
+	size_t gif_len = 0;
+	size_t block_len = 0;
+	size_t canvas_size;
+	uint16_t gct_size = 0;		/* global color table size */
+	unsigned frames = 0;		/* images drawn so far */
+	unsigned count;
+	int ret;
+	stats_time_t mark;
+	uint8_t byte;
+
+	/* Use private context if caller has not provided one */
+	if (ctx == NULL) {
+		if ((ctx = own_ctx = gif_ctx_create(NULL)) == NULL)
+			GIF_ERROR("Not enough memory\n");
+	}
+	if (in.wait) {
+		in.gct = ctx->ct_copy[0];
+		in.lct = ctx->ct_copy[1];
+	}
+	STATS_START(ctx, mark);
+
+	/* Parse Header */
+	if ((block_len = load_header(&header, &in)) == 0)
+		GIF_ERROR("GIF: Invalid header\n");
+	gif_len += block_len;
+
+	/* Parse Logical Screen Descriptor */
+	if ((block_len = load_lsd(&lsd, &in)) == 0)
+		GIF_ERROR("GIF: Invalid Local Screen Descriptor\n");
+	gif_len += block_len;
+
+	/* Parse Global Color Table - if present */
+	if (lsd.field.gct_flag) {
+		if ((block_len = load_color_table(&gct,
+			COLOR_TABLE_SIZE(lsd.field.gct_size), &in,
+			in.gct)) == 0) {
+			GIF_ERROR("GIF: Invalid Global Color Table\n");
+		}
+		gif_len += block_len;
+		gct_size = COLOR_TABLE_SIZE(lsd.field.gct_size);
+	}
+
+	/* Background color - black if there is no global color table. It is
+	   transparent in BGRA, as areas no image covers are */
+	ctx->bg_index = lsd.transID;
+	memset(ctx->bg_rgb, 0, sizeof(ctx->bg_rgb));
+	if (gct && lsd.transID * 3u < gct_size) {
+		ctx->bg_rgb[0] = gct[lsd.transID].r;
+		ctx->bg_rgb[1] = gct[lsd.transID].g;
+		ctx->bg_rgb[2] = gct[lsd.transID].b;
+		if (p_img->format == IMG_BGR || p_img->format == IMG_BGRA) {
+			ctx->bg_rgb[0] = gct[lsd.transID].b;
+			ctx->bg_rgb[2] = gct[lsd.transID].r;
+		}
+	}
+	ctx->rows_out = 0;
+	ctx->sink_done = 0;
+
+	/* Check label - determine which block follows */
+	if (in_read(&in, &byte, 1) == 0)
+		GIF_ERROR("GIF: missing file content\n");
+	gif_len++;
+	STATS_STOP(ctx, mark, header);
+
+	/* Canvas set up counts as LZW stage */
+	STATS_START(ctx, mark);
+	canvas_size = (size_t) lsd.height * IMG_ROW_SIZE(p_img->format,
+		lsd.width);
+	p_img->width  = lsd.width;
+	p_img->height = lsd.height;
+	if (canvas_alloc(ctx, p_img, canvas_size))
+		GIF_ERROR("Not enough memory\n");
+	if (ctx->opts.row_sink == NULL)
+		canvas_pad(p_img);
+	stats_lzw(ctx, &mark);
+
+	/* Animation may be decoded by several threads - the whole stream is
+	   pre-scanned first (its time counts as header stage). Not when
+	   preview is requested, it has to come before the rest is decoded,
+	   nor when the input is fed by wait, which releases it */
+	if (ctx->opts.threads > 1 && ctx->opts.row_sink == NULL
+		&& ctx->opts.preview_sink == NULL && in.wait == NULL) {
+		STATS_START(ctx, mark);
+		scan = in;
+		count = images_scan(ctx, &scan, byte, gct, gct_size);
+		STATS_STOP(ctx, mark, header);
+
+		if (count) {
+			STATS_START(ctx, mark);
+			if ((ret = images_load(ctx, p_img, count, scan.end,
+				&frames)) > 0) {
+				gif_len = 0;
+				goto gif_err;
+			}
+			stats_lzw(ctx, &mark);
+			if (ret == 0) {
+				gif_len += scan.pos - in.pos;
+				goto gif_end;
+			}
+		}
+	}
+
+	/* Parse Data Streams */
+	do {
+		if ((block_len = scan_image(&in, byte, gct, gct_size, &image,
+			ctx->opts.stats, &err)) == 0)
+			GIF_ERROR(err);
+		gif_len += block_len;
+
+		/* Disposal and decoding count as LZW stage */
+		STATS_START(ctx, mark);
+		if (image_begin(ctx, p_img, &image, frames))
+			GIF_ERROR("Not enough memory\n");
+
+		/* Parse image data */
+		if ((block_len = load_image(ctx, p_img, image.ct_size,
+			&in)) == 0)
+			GIF_ERROR("GIF: Invalid picture data\n");
+		gif_len += block_len;
+		stats_lzw(ctx, &mark);
+		frames++;
+
+		/* Only the first image is streamed */
+		if (ctx->opts.row_sink)
+			goto gif_end;
+
+		if (image_end(ctx, p_img, frames - 1))
+			GIF_ERROR("GIF: frame output failed\n");
+
+		/* Read empty block */
+		do {
+			if (in_read(&in, &byte, 1) == 0)
 				GIF_ERROR("GIF: missing file content\n");
 			gif_len++;
 		} while (byte == 0);
@@ -773,18 +2044,277 @@ size_t gif_load(image_t *p_img, FILE *f_gif)
 	goto gif_end;
 
 gif_err:
+	/* Canvas is kept allocated for reuse - it is freed by caller */
 	gif_len = 0;
 	p_img->width = p_img->height = 0;
-	if (p_img->data) {
-		free(p_img->data);
-		p_img->data = NULL;
-	}
 gif_end:
-	if (gct)
-		free(gct);
-	if (lct)
-		free(lct);
+	if (ctx && ctx->opts.stats)
+		stats_done(ctx, p_img, gif_len, frames);
+	gif_ctx_destroy(own_ctx);
+
+	return gif_len;
+}
+
+size_t gif_load_mem(image_t *p_img, const uint8_t *buf, size_t len,
+	gif_ctx_t *ctx)
+{
+	gif_in_t in = { .pos = buf, .end = buf + len };
+
+	return load_gif(p_img, in, ctx);
+}
+
+size_t gif_load_feed(image_t *p_img, gif_wait_fn wait, void *opaque,
+	gif_ctx_t *ctx)
+{
+	gif_in_t in = { .wait = wait, .opaque = opaque };
+	size_t avail;
+
+	assert(wait);
+
+	/* The first window, whatever is there already */
+	in.pos = in.buf = wait(opaque, 0, 0, &avail);
+	in.end = in.buf + avail;
+
+	return load_gif(p_img, in, ctx);
+}
+
+/* Read callback of stdio stream */
+static size_t file_read(void *opaque, void *buf, size_t size)
+{
+	FILE *f_gif = (FILE *) opaque;
+	size_t cnt = fread(buf, 1, size, f_gif);
+
+	return (cnt == 0 && ferror(f_gif)) ? (size_t) -1 : cnt;
+}
+
+/* Read the whole stream into memory - len bytes of buffer of size bytes.
+   Returns NULL on error */
+static uint8_t *read_all(gif_read_fn read, void *opaque,
+	const mem_alloc_t *alloc, size_t *len, size_t *size)
+{
+	uint8_t *buf = NULL;
+	uint8_t *tmp;
+	size_t cnt;
+
+	*len = *size = 0;
+	do {
+		if (*len == *size) {
+			*size = (*size) ? *size * 2 : 65536;
+			if ((tmp = (uint8_t *) mem_realloc(alloc, buf, *size))
+				== NULL) {
+				fprintf(stderr, "Not enough memory\n");
+				goto read_err;
+			}
+			buf = tmp;
+		}
+		cnt = read(opaque, buf + *len, *size - *len);
+		if (cnt == (size_t) -1) {
+			fprintf(stderr, "GIF: read error\n");
+			goto read_err;
+		}
+		*len += cnt;
+	} while (cnt > 0);
+
+	return buf;
+
+read_err:
+	mem_free(alloc, buf);
+
+	return NULL;
+}
+
+size_t gif_load_cb(image_t *p_img, gif_read_fn read, void *opaque,
+	gif_ctx_t *ctx)
+{
+	const mem_alloc_t *alloc = (ctx) ? CTX_ALLOC(ctx) : NULL;
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+	size_t gif_len;
+	stats_t *stats = (ctx) ? ctx->opts.stats : NULL;
+	stats_time_t mark;
+
+	/* Read the whole stream into memory, then parse it from there */
+	if (stats)
+		stats_start(&mark);
+	if ((buf = read_all(read, opaque, alloc, &len, &size)) == NULL)
+		return 0;
+	if (stats)
+		stats_stop(&mark, &stats->read);
+
+	gif_len = gif_load_mem(p_img, buf, len, ctx);
+
+	/* Stream buffer is held together with decoder buffers */
+	if (stats && stats->peak_alloc < stats->alloc + size)
+		stats->peak_alloc = stats->alloc + size;
+
+	mem_free(alloc, buf);
 
 	return gif_len;
 }
 
+size_t gif_load(image_t *p_img, FILE *f_gif, gif_ctx_t *ctx)
+{
+	return gif_load_cb(p_img, file_read, f_gif, ctx);
+}
+
+/* Walk the blocks of GIF, returns 0 on error (reported) */
+static int probe_gif(gif_info_t *info, gif_in_t *in)
+{
+	struct GIF_header header;
+	struct GIF_lsd lsd;
+	gif_image_t image;
+	const struct GIF_ct *gct = NULL;	/* global color table */
+	const char *err;
+	uint16_t gct_size = 0;		/* global color table size */
+	uint8_t dict_width;
+	uint8_t byte;
+
+	assert(info);
+	memset(info, 0, sizeof(gif_info_t));
+	info->loops = -1;
+
+	if (load_header(&header, in) == 0) {
+		fprintf(stderr, "GIF: Invalid header\n");
+		return 0;
+	}
+	if (load_lsd(&lsd, in) == 0) {
+		fprintf(stderr, "GIF: Invalid Local Screen Descriptor\n");
+		return 0;
+	}
+	if (lsd.field.gct_flag) {
+		gct_size = COLOR_TABLE_SIZE(lsd.field.gct_size);
+		if (load_color_table(&gct, gct_size, in, in->gct) == 0) {
+			fprintf(stderr, "GIF: Invalid Global Color Table\n");
+			return 0;
+		}
+	}
+	info->width = lsd.width;
+	info->height = lsd.height;
+	info->gct_colors = gct_size / 3u;
+
+	if (in_read(in, &byte, 1) == 0) {
+		fprintf(stderr, "GIF: missing file content\n");
+		return 0;
+	}
+
+	/* Walk the images - their data are skipped by sub-block sizes */
+	do {
+		if (scan_image(in, byte, gct, gct_size, &image, NULL,
+			&err) == 0) {
+			fputs(err, stderr);
+			return 0;
+		}
+		if (in_read(in, &dict_width, 1) == 0 || dict_width > 8) {
+			fprintf(stderr, "GIF: LZW error\n");
+			return 0;
+		}
+		if (in_skip_blocks(in) == 0) {
+			fprintf(stderr, "GIF: Invalid picture data\n");
+			return 0;
+		}
+
+		info->frames++;
+		if (image.ct != gct) {
+			info->lct_frames++;
+			if (info->lct_colors < image.ct_size / 3u)
+				info->lct_colors = image.ct_size / 3u;
+		}
+		info->interlaced += image.frame.interlace;
+		info->transparent += (image.frame.trans >= 0);
+		info->delay += image.delay;
+		if (image.loops >= 0)
+			info->loops = image.loops;
+
+		/* Read empty block */
+		do {
+			if (in_read(in, &byte, 1) == 0) {
+				fprintf(stderr, "GIF: missing file content\n");
+				return 0;
+			}
+		} while (byte == 0);
+	} while (byte != TRAILER);
+
+	return 1;
+}
+
+size_t gif_probe_mem(gif_info_t *info, const uint8_t *buf, size_t len)
+{
+	gif_in_t in = { .pos = buf, .end = buf + len };
+
+	return (probe_gif(info, &in)) ? (size_t) (in.pos - buf) : 0;
+}
+
+/* Input of probe read by callback into window of its own - skipped image
+   data are released as the probe walks past them, so the window holds a few
+   sub-blocks (or a color table) at most */
+#define PROBE_WINDOW	(1u << 16)
+
+typedef struct
+{
+	gif_read_fn read;
+	void *opaque;
+	uint8_t *buf;
+	size_t size;		/* Bytes of buf */
+	size_t len;		/* Bytes read into buf */
+	size_t released;	/* Bytes released before buf */
+	int err;
+} probe_in_t;
+
+/* gif_wait_fn of probe - released bytes are dropped, window is filled up by
+   read until it holds len bytes (or the stream ends) */
+static const uint8_t *probe_wait(void *opaque, size_t used, size_t len,
+	size_t *avail)
+{
+	probe_in_t *p = (probe_in_t *) opaque;
+	size_t cnt;
+
+	memmove(p->buf, p->buf + used, p->len - used);
+	p->len -= used;
+	p->released += used;
+
+	while (p->len < len && !p->err) {
+		cnt = p->read(p->opaque, p->buf + p->len, p->size - p->len);
+		if (cnt == (size_t) -1) {
+			fprintf(stderr, "GIF: read error\n");
+			p->err = 1;
+		}
+		else if (cnt == 0)
+			break;
+		else
+			p->len += cnt;
+	}
+	*avail = p->len;
+
+	return p->buf;
+}
+
+size_t gif_probe_cb(gif_info_t *info, gif_read_fn read, void *opaque)
+{
+	struct GIF_ct ct_copy[2][256];
+	probe_in_t p = { .read = read, .opaque = opaque, .size = PROBE_WINDOW };
+	gif_in_t in = { .wait = probe_wait, .opaque = &p,
+		.gct = ct_copy[0], .lct = ct_copy[1] };
+	size_t gif_len = 0;
+	size_t avail;
+
+	if ((p.buf = (uint8_t *) malloc(p.size)) == NULL) {
+		fprintf(stderr, "Not enough memory\n");
+		return 0;
+	}
+
+	/* The first window, as much as one read gives */
+	in.pos = in.buf = probe_wait(&p, 0, 1, &avail);
+	in.end = in.buf + avail;
+
+	if (probe_gif(info, &in) && !p.err)
+		gif_len = p.released + (in.pos - in.buf);
+	free(p.buf);
+
+	return gif_len;
+}
+
+size_t gif_probe(gif_info_t *info, FILE *f_gif)
+{
+	return gif_probe_cb(info, file_read, f_gif);
+}
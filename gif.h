@@ -11,9 +11,109 @@
 #ifndef GIF_H
 #define GIF_H
 
-#include "gif2bmp.h"
+#include <stdio.h>
 
-extern size_t gif_load(image_t *p_img, FILE *f_gif);
+#include "image.h"
+#include "stats.h"
+#include "alloc.h"
+#include "arena.h"
+
+/* Decoder context - one per concurrently running gif_load() */
+typedef struct gif_ctx gif_ctx_t;
+
+/* Row sink - gets every completed image row (in img->format), top to bottom.
+   Returning non-zero aborts decoding, GIF_ROW_DONE ends it successfully -
+   rest of image data is skipped then */
+typedef int (*gif_row_fn)(void *opaque, const image_t *img, uint16_t y,
+	const uint8_t *row);
+
+#define GIF_ROW_DONE		2
+
+/* Frame sink - gets canvas once every image of animation is drawn into it.
+   Returning non-zero aborts decoding */
+typedef int (*gif_frame_fn)(void *opaque, const image_t *img, unsigned index);
+
+/* Read callback - fills up to size bytes of buf, returns their number,
+   0 at the end of stream or (size_t) -1 on error */
+typedef size_t (*gif_read_fn)(void *opaque, void *buf, size_t size);
+
+/* Wait callback of input which is being read by another thread into window
+   of its own - the first 'used' bytes of the window it returned last are
+   released (nothing points into them any more). Blocks until at least len
+   bytes past them are there (or the input ends), returns the window which
+   starts with them and the number of its bytes in avail. Bytes it returned
+   before may be overwritten then */
+typedef const uint8_t *(*gif_wait_fn)(void *opaque, size_t used, size_t len,
+	size_t *avail);
+
+/* Decoding options */
+typedef struct
+{
+	gif_row_fn row_sink;	/* Stream rows instead of filling img->data,
+				   only the first image is decoded then */
+	gif_frame_fn frame_sink;	/* Ignored when streaming rows */
+	gif_frame_fn preview_sink;	/* Gets canvas once pass 1 of the first
+					   image is drawn - if the image is
+					   interlaced, its rows replicated.
+					   Ignored when streaming rows */
+	void *opaque;		/* Passed to row_sink/frame_sink */
+	stats_t *stats;		/* Decoder statistics are added here if set */
+	arena_t *arena;		/* If set, it is reset for every image and
+				   canvas is taken from it - img->data is
+				   valid until the next image then, and it
+				   must not be freed by caller */
+	unsigned threads;	/* Images of animation may be decoded by up
+				   to this many threads at once, while the
+				   calling thread composites them. Sinks are
+				   still called from the calling thread.
+				   Ignored when preview_sink is set, and by
+				   gif_load_feed() */
+} gif_opts_t;
+
+/* Summary of GIF stream - found by walking its blocks, image data are
+   skipped by their sub-block sizes, nothing is decoded */
+typedef struct gif_info
+{
+	uint16_t width;		/* Logical screen */
+	uint16_t height;
+	uint16_t gct_colors;	/* Global Color Table entries, 0 if none */
+	uint16_t lct_colors;	/* Entries of the largest Local Color Table */
+	unsigned frames;	/* Images */
+	unsigned lct_frames;	/* Images with Local Color Table */
+	unsigned interlaced;	/* Interlaced images */
+	unsigned transparent;	/* Images with transparent color */
+	int loops;		/* Loop count (0 - forever), -1 if not given */
+	uint64_t delay;		/* Sum of image delays, 1/100 s */
+} gif_info_t;
+
+/* All buffers of the context and image data it loads are taken from alloc
+   (malloc() and friends if NULL) - p_img->data has to be freed by it too */
+extern gif_ctx_t *gif_ctx_create(const mem_alloc_t *alloc);
+extern void gif_ctx_destroy(gif_ctx_t *ctx);
+extern void gif_ctx_set_opts(gif_ctx_t *ctx, const gif_opts_t *opts);
+
+/* All images of animation are composited, p_img holds the last frame.
+   ctx may be NULL - private context is created for this call only */
+extern size_t gif_load(image_t *p_img, FILE *f_gif, gif_ctx_t *ctx);
+/* Read the whole stream by read, then parse it */
+extern size_t gif_load_cb(image_t *p_img, gif_read_fn read, void *opaque,
+	gif_ctx_t *ctx);
+/* Parse GIF held in memory - buf must stay valid during the call only */
+extern size_t gif_load_mem(image_t *p_img, const uint8_t *buf, size_t len,
+	gif_ctx_t *ctx);
+/* Parse GIF while another thread reads it - only bytes of windows given by
+   wait are touched, each one until the next call of wait. Threads are not
+   used then */
+extern size_t gif_load_feed(image_t *p_img, gif_wait_fn wait, void *opaque,
+	gif_ctx_t *ctx);
+
+/* Probe GIF without decoding - the whole stream is checked, returns number
+   of bytes parsed, 0 on error */
+extern size_t gif_probe_mem(gif_info_t *info, const uint8_t *buf, size_t len);
+/* Stream is read in small window, skipped image data are dropped as they
+   are read - it is never held in memory whole */
+extern size_t gif_probe_cb(gif_info_t *info, gif_read_fn read, void *opaque);
+extern size_t gif_probe(gif_info_t *info, FILE *f_gif);
 
 #endif // GIF_H
 
@@ -8,34 +8,345 @@
  * published by the Free Software Foundation.
  */
 
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
 #include <string.h>
 #include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "gif2bmp.h"
 #include "gif.h"
 #include "bmp.h"
+#include "scale.h"
+#include "crop.h"
+#include "pipe.h"
+#include "batch.h"
+#include "serve.h"
+#include "stats.h"
+
+/* Command line arguments */
+typedef struct
+{
+	char *s_input;
+	char *s_output;
+	char *s_list;		/* Batch list file */
+	int nul_list;		/* Batch list is NUL separated on stdin */
+	unsigned jobs;		/* Number of batch (or server) workers */
+	char *s_socket;		/* Server mode socket */
+	int info;		/* Probe input only, no conversion */
+	conv_opts_t conv;
+} args_t;
 
-static int gif2bmp(FILE *input, FILE *output);
+static int frame_save(void *opaque, const image_t *img, unsigned index);
+static int preview_save(void *opaque, const image_t *img, unsigned index);
+static void io_guard(void);
+static const uint8_t *io_map(FILE *f_input, size_t *len);
+static int io_unmap(FILE *f_input, const uint8_t *data, size_t len);
 static void usage(void);
-static int args_parse(int argc, char * const argv[],
-	char **s_input, char **s_output);
+static int crop_parse(const char *s, img_rect_t *rect);
+static int args_parse(int argc, char * const argv[], args_t *args);
 static int io_open(char *s_input, char *s_output, FILE **f_input, FILE **f_output);
 static void io_close(FILE *f_input, FILE *f_output);
+static unsigned cpus(void);
+static int run_batch(const args_t *args);
+static int run_serve(const args_t *args);
+static int run_info(const args_t *args);
 
-static int gif2bmp(FILE *input, FILE *output)
+/* Where to write frames of animation and preview */
+typedef struct
 {
-	image_t img = { .data = NULL} ;
+	const char *s_output;
+	const char *s_preview;
+	unsigned threads;
+	const mem_alloc_t *alloc;
+	stats_t *stats;
+} outputs_t;
+
+int gif2bmp(FILE *input, FILE *output, const char *s_output, image_t *img,
+	struct gif_ctx *ctx, arena_t *arena, const conv_opts_t *opts,
+	stats_t *stats)
+{
+	gif_opts_t gif_opts = { .row_sink = NULL, .frame_sink = NULL,
+		.stats = stats, .arena = arena, .threads = opts->threads };
+	outputs_t outputs = { .s_output = s_output,
+		.s_preview = opts->s_preview, .threads = opts->threads,
+		.alloc = &arena->alloc, .stats = stats };
+	bmp_stream_t bmp;
+	scale_t scale;
+	crop_t crop;
+	pipe_t pipeline;
+	int stream = opts->stream || opts->pipeline;
+	int scaled = opts->scale > 1 || opts->max_dim;
+	int cropped = opts->crop.width > 0;
+	const uint8_t *gif;
+	size_t gif_size;
+	size_t ret;
 
-	/* TODO - linked list of images - parse GIF animations */
-	if (gif_load(&img, input)) {
-		bmp_save(&img, output);
-		free(img.data);
+	/* Streamed rows go right into the BMP writer - pipelined ones are
+	   written by writer thread, which has stats of its own and does not
+	   touch arena of the decoder */
+	img->format = opts->format;
+	if (stream) {
+		if (opts->pipeline)
+			bmp_stream_open(&bmp, output, NULL,
+				(stats) ? &pipeline.stats : NULL);
+		else
+			bmp_stream_open(&bmp, output, &arena->alloc, stats);
+		gif_opts.row_sink = bmp_stream_row;
+		gif_opts.opaque = &bmp;
+	}
+	else {
+		if (opts->frames && s_output)
+			gif_opts.frame_sink = frame_save;
+		if (opts->s_preview)
+			gif_opts.preview_sink = preview_save;
+		gif_opts.opaque = &outputs;
 	}
 
-	return 0;
+	/* Rows are handed over to writer thread in bands, input is read ahead
+	   by reader thread */
+	if (opts->pipeline) {
+		if (pipe_open(&pipeline, input, gif_opts.row_sink,
+			gif_opts.opaque, NULL))
+			return 1;
+		gif_opts.row_sink = pipe_row;
+		gif_opts.opaque = &pipeline;
+	}
+
+	/* Reduced image is put together from streamed rows - no canvas, and
+	   its rows go either to BMP stream, or into image of its own */
+	if (scaled) {
+		scale_open(&scale, opts->scale, opts->max_dim,
+			gif_opts.row_sink, gif_opts.opaque, &arena->alloc);
+		gif_opts.row_sink = scale_row;
+		gif_opts.opaque = &scale;
+	}
+
+	/* Rectangle is cut out first (then scaled), decoding stops right
+	   after its last row */
+	if (cropped) {
+		crop_open(&crop, &opts->crop, gif_opts.row_sink,
+			gif_opts.opaque, &arena->alloc);
+		gif_opts.row_sink = crop_row;
+		gif_opts.opaque = &crop;
+	}
+	gif_ctx_set_opts(ctx, &gif_opts);
+
+	/* Parse regular files straight from the page cache, pipes via stdio */
+	if (opts->pipeline) {
+		ret = pipe_load(&pipeline, img, ctx);
+		ret = pipe_close(&pipeline, stats) == 0 && ret;
+	}
+	else if ((gif = io_map(input, &gif_size)) != NULL) {
+		ret = gif_load_mem(img, gif, gif_size, ctx);
+		ret = io_unmap(input, gif, gif_size) == 0 && ret;
+	}
+	else
+		ret = gif_load(img, input, ctx);
+
+	if (cropped) {
+		ret = crop_close(&crop) == 0 && ret;
+		img = &crop.img;
+	}
+	if (scaled) {
+		ret = scale_close(&scale) == 0 && ret;
+		img = &scale.img;
+	}
+
+	/* Output gets the last frame of animation */
+	if (stream)
+		ret = bmp_stream_close(&bmp, img) && ret;
+	else if (ret)
+		ret = bmp_save(img, output, opts->threads, &arena->alloc, stats);
+
+	return (ret) ? 0 : 1;
+}
+
+/* Write composited frame as 'output-NNN.bmp' (without '.bmp' of output) */
+static int frame_save(void *opaque, const image_t *img, unsigned index)
+{
+	const outputs_t *outputs = (const outputs_t *) opaque;
+	const char *s_output = outputs->s_output;
+	size_t len = strlen(s_output);
+	char *s_frame;
+	FILE *f_frame;
+	int ret = 1;
+
+	if (len >= 4 && strcmp(s_output + len - 4, ".bmp") == 0)
+		len -= 4;
+
+	if ((s_frame = (char *) malloc(len + 16)) == NULL) {
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+	sprintf(s_frame, "%.*s-%03u.bmp", (int) len, s_output, index);
+
+	if ((f_frame = fopen(s_frame, "w+b")) == NULL) {
+		fprintf(stderr, "Error: opening file '%s': %s\n",
+			s_frame, strerror(errno));
+		goto frame_err;
+	}
+
+	if (bmp_save(img, f_frame, outputs->threads, outputs->alloc,
+		outputs->stats))
+		ret = 0;
+	if (fclose(f_frame))
+		ret = 1;
+
+frame_err:
+	free(s_frame);
+
+	return ret;
+}
+
+/* Write preview of interlaced image, before the rest of it is decoded */
+static int preview_save(void *opaque, const image_t *img, unsigned index)
+{
+	const outputs_t *outputs = (const outputs_t *) opaque;
+	FILE *f_preview;
+	int ret = 1;
+
+	if ((f_preview = fopen(outputs->s_preview, "w+b")) == NULL) {
+		fprintf(stderr, "Error: opening file '%s' (preview of image "
+			"%u): %s\n", outputs->s_preview, index,
+			strerror(errno));
+		return 1;
+	}
+
+	if (bmp_save(img, f_preview, outputs->threads, outputs->alloc,
+		outputs->stats))
+		ret = 0;
+	if (fclose(f_preview))
+		ret = 1;
+
+	return ret;
+}
+
+/* Input files mapped at the moment. A file truncated while it is mapped
+   raises SIGBUS once a page past its new end is touched (by any thread of
+   the conversion) - such pages are replaced by zeros in io_sigbus() and the
+   conversion fails instead of the whole process */
+#define IO_MAPS		64u
+
+static struct
+{
+	int used;		/* Slot is claimed */
+	const uint8_t *data;	/* Set once len is, NULL if the slot is free */
+	size_t len;
+	volatile sig_atomic_t truncated;
+} io_maps[IO_MAPS];
+static size_t io_page;
+
+/* POSIX does not list mmap() as async-signal-safe - this relies on Linux,
+   where it is a plain system call, so it can be made from the handler */
+static void io_sigbus(int sig, siginfo_t *info, void *uctx)
+{
+	const uint8_t *addr = (const uint8_t *) info->si_addr;
+	const uint8_t *data;
+	const uint8_t *page;
+
+	(void) uctx;
+	for (unsigned i = 0; i < IO_MAPS; i++) {
+		data = __atomic_load_n(&io_maps[i].data, __ATOMIC_ACQUIRE);
+		if (data == NULL || addr < data || addr >= data
+			+ io_maps[i].len)
+			continue;
+
+		/* The rest of the mapping reads as zeros from now on */
+		page = data + ((addr - data) & ~(io_page - 1));
+		if (mmap((void *) page, data + io_maps[i].len - page,
+			PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+			-1, 0) == MAP_FAILED)
+			break;
+		io_maps[i].truncated = 1;
+		return;
+	}
+
+	/* Not an input mapping - fault again, with the default action */
+	signal(sig, SIG_DFL);
+}
+
+/* Install SIGBUS handler of input mappings - before any thread starts */
+static void io_guard(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = io_sigbus;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGBUS, &sa, NULL) == 0)
+		io_page = sysconf(_SC_PAGESIZE);
+}
+
+/* Map regular file - NULL if it cannot be mapped (or guarded), it is read
+   through stdio then */
+static const uint8_t *io_map(FILE *f_input, size_t *len)
+{
+	struct stat st;
+	int expected;
+	void *data;
+
+	if (io_page == 0 || fstat(fileno(f_input), &st)
+		|| !S_ISREG(st.st_mode) || st.st_size == 0)
+		return NULL;
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+		fileno(f_input), 0);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	/* Claim a slot - mappings of batch workers come and go at once */
+	for (unsigned i = 0; i < IO_MAPS; i++) {
+		expected = 0;
+		if (!__atomic_compare_exchange_n(&io_maps[i].used, &expected,
+			1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			continue;
+		io_maps[i].len = st.st_size;
+		io_maps[i].truncated = 0;
+		__atomic_store_n(&io_maps[i].data, (const uint8_t *) data,
+			__ATOMIC_RELEASE);
+		*len = st.st_size;
+		return (const uint8_t *) data;
+	}
+
+	munmap(data, st.st_size);
+
+	return NULL;
+}
+
+/* Returns non-zero if the file has been truncated while it was mapped - its
+   last page past the new end reads as zeros, so that does not fault at all */
+static int io_unmap(FILE *f_input, const uint8_t *data, size_t len)
+{
+	struct stat st;
+	int truncated = 0;
+
+	for (unsigned i = 0; i < IO_MAPS; i++) {
+		if (__atomic_load_n(&io_maps[i].data, __ATOMIC_RELAXED)
+			!= data)
+			continue;
+		truncated = io_maps[i].truncated;
+		__atomic_store_n(&io_maps[i].data, NULL, __ATOMIC_RELEASE);
+		__atomic_store_n(&io_maps[i].used, 0, __ATOMIC_RELEASE);
+		break;
+	}
+	munmap((void *) data, len);
+
+	if (fstat(fileno(f_input), &st) == 0 && (size_t) st.st_size < len)
+		truncated = 1;
+	if (truncated)
+		fprintf(stderr, "Error: input file truncated while it was "
+			"read\n");
+
+	return truncated;
 }
 
 static void usage(void)
@@ -43,22 +354,150 @@ static void usage(void)
 	printf("gif2bmp usage:\n" \
 		"-i\tinput GIF file\n" \
 		"-o\toutput BMP file\n" \
+		"-p\twrite palettized (8/4/1 bpp) BMP\n" \
+		"--alpha\twrite 32bpp BGRA BMP, transparent pixels (and "
+			"background) get\n\talpha 0\n" \
+		"-t\tstream rows into top-down BMP (no full canvas in memory)\n" \
+		"-a\talso write every frame of animation as 'output-NNN.bmp'\n" \
+		"-s\tdownscale by integer factor while decoding (first image "
+			"only, as\n\twith -t)\n" \
+		"--max-dim N\n\tdownscale so that the larger side is at most N "
+			"pixels\n" \
+		"--crop X,Y,W,H\n\tconvert W x H rectangle at X,Y only (first "
+			"image, as with -t),\n\tdecoding stops after its last "
+			"row\n" \
+		"--pipeline\n\tread input and write BMP rows by threads of "
+			"their own, while the first\n\timage is decoded (as "
+			"with -t)\n" \
+		"-l\tbatch mode - list file of 'input<TAB>output' lines\n" \
+		"-0\tbatch mode - NUL separated input/output pairs on stdin\n" \
+		"-j\tnumber of batch (or server) worker threads, or of threads "
+			"decoding\n\tanimation and writing BMP file (default: "
+			"number of CPUs)\n" \
+		"--preview FILE\n\twrite BMP of interlaced image into FILE as soon as "
+			"its first pass\n\tis decoded (every 8th row, replicated)\n" \
+		"--serve SOCKET\n\tconvert GIF images sent over Unix domain "
+			"socket (see serve.h)\n" \
+		"--huge-pages\n\tback large canvases by transparent hugepages\n" \
+		"--info\tprint summary of input GIF (size, frames, color tables, "
+			"loops,\n\tdelays) as JSON line to stdout, without "
+			"decoding it\n" \
+		"--stats\tprint timings and decoder counters of every image as "
+			"JSON line to stderr\n" \
 		"-h\tdisplay this help and exit\n");
 }
 
-static int args_parse(int argc, char * const argv[],
-char **s_input, char **s_output)
+/* Parse 'X,Y,W,H' - rectangle has to be within 16-bit GIF coordinates */
+static int crop_parse(const char *s, img_rect_t *rect)
 {
+	unsigned x, y, w, h;
+	char end;
+
+	if (sscanf(s, "%u,%u,%u,%u%c", &x, &y, &w, &h, &end) != 4
+		|| x > UINT16_MAX || y > UINT16_MAX || w == 0 || h == 0
+		|| w > UINT16_MAX || h > UINT16_MAX)
+		return 1;
+
+	rect->left = x;
+	rect->top = y;
+	rect->width = w;
+	rect->height = h;
+
+	return 0;
+}
+
+static int args_parse(int argc, char * const argv[], args_t *args)
+{
+	static const struct option long_opts[] = {
+		{ "stats", no_argument, NULL, 'S' },
+		{ "preview", required_argument, NULL, 'P' },
+		{ "serve", required_argument, NULL, 'V' },
+		{ "huge-pages", no_argument, NULL, 'H' },
+		{ "info", no_argument, NULL, 'I' },
+		{ "max-dim", required_argument, NULL, 'M' },
+		{ "crop", required_argument, NULL, 'C' },
+		{ "alpha", no_argument, NULL, 'A' },
+		{ "pipeline", no_argument, NULL, 'L' },
+		{ NULL, 0, NULL, 0 }
+	};
 	int chr;
 
 	opterr = 0; /* disable error messages by getopt() */
-	while ((chr = getopt(argc, argv, "i:o:h")) != -1) {
+	while ((chr = getopt_long(argc, argv, "i:o:ptas:l:0j:h", long_opts,
+		NULL)) != -1) {
 		switch (chr) {
 		case 'i':
-			*s_input = optarg;
+			args->s_input = optarg;
 			break;
 		case 'o':
-			*s_output = optarg;
+			args->s_output = optarg;
+			break;
+		case 'p':
+		case 'A':
+			/* Both choose the output pixel format - repeating
+			   either one is fine */
+			if (args->conv.format == ((chr == 'p') ? IMG_BGRA
+				: IMG_INDEXED)) {
+				fprintf(stderr, "Error: -p cannot be used "
+					"with --alpha\n");
+				return 1;
+			}
+			args->conv.format = (chr == 'p') ? IMG_INDEXED
+				: IMG_BGRA;
+			break;
+		case 't':
+			args->conv.stream = 1;
+			break;
+		case 'a':
+			args->conv.frames = 1;
+			break;
+		case 'S':
+			args->conv.stats = 1;
+			break;
+		case 'P':
+			args->conv.s_preview = optarg;
+			break;
+		case 'V':
+			args->s_socket = optarg;
+			break;
+		case 'H':
+			args->conv.huge = 1;
+			break;
+		case 'I':
+			args->info = 1;
+			break;
+		case 'L':
+			args->conv.pipeline = 1;
+			break;
+		case 's':
+		case 'M':
+			if (atoi(optarg) <= 0) {
+				usage();
+				return 1;
+			}
+			if (chr == 's')
+				args->conv.scale = atoi(optarg);
+			else
+				args->conv.max_dim = atoi(optarg);
+			break;
+		case 'C':
+			if (crop_parse(optarg, &args->conv.crop)) {
+				usage();
+				return 1;
+			}
+			break;
+		case 'l':
+			args->s_list = optarg;
+			break;
+		case '0':
+			args->nul_list = 1;
+			break;
+		case 'j':
+			if (atoi(optarg) <= 0) {
+				usage();
+				return 1;
+			}
+			args->jobs = atoi(optarg);
 			break;
 		case 'h':
 		case '?':
@@ -72,6 +511,56 @@ char **s_input, char **s_output)
 		return 1;
 	}
 
+	/* Frames are named after output file, streaming keeps one image only */
+	if (args->conv.frames && (args->conv.stream
+		|| (args->s_output == NULL && args->s_list == NULL
+		&& !args->nul_list))) {
+		fprintf(stderr, "Error: -a needs -o (or batch mode), "
+			"and cannot be used with -t\n");
+		return 1;
+	}
+
+	/* Downscaled (cropped, pipelined) image is streamed, like -t */
+	if ((args->conv.scale || args->conv.max_dim || args->conv.crop.width
+		|| args->conv.pipeline)
+		&& (args->conv.frames || args->conv.s_preview)) {
+		fprintf(stderr, "Error: -s, --max-dim, --crop and --pipeline "
+			"cannot be used with -a or --preview\n");
+		return 1;
+	}
+
+	/* Server gets images from its clients only */
+	if (args->s_socket && (args->s_input || args->s_output
+		|| args->s_list || args->nul_list || args->conv.stream
+		|| args->conv.frames || args->conv.s_preview
+		|| args->conv.scale || args->conv.max_dim
+		|| args->conv.crop.width || args->conv.pipeline)) {
+		fprintf(stderr, "Error: --serve cannot be used with -i, -o, "
+			"-t, -a, -s, --max-dim, --crop, --pipeline, --preview "
+			"or batch mode\n");
+		return 1;
+	}
+
+	/* Probe reads one input and writes nothing but its summary */
+	if (args->info && (args->s_output || args->s_list || args->nul_list
+		|| args->s_socket || args->conv.stream || args->conv.frames
+		|| args->conv.s_preview || args->conv.scale
+		|| args->conv.max_dim || args->conv.crop.width
+		|| args->conv.pipeline)) {
+		fprintf(stderr, "Error: --info cannot be used with -o, -t, -a, "
+			"-s, --max-dim, --crop, --pipeline, --preview, --serve "
+			"or batch mode\n");
+		return 1;
+	}
+
+	/* Preview is there to show one image early */
+	if (args->conv.s_preview && (args->conv.stream || args->s_list
+		|| args->nul_list)) {
+		fprintf(stderr, "Error: --preview cannot be used with -t "
+			"or batch mode\n");
+		return 1;
+	}
+
 	return 0;
 }
 
@@ -89,7 +578,8 @@ static int io_open(char *s_input, char *s_output, FILE **f_input, FILE **f_outpu
 		*f_input = stdin;
 
 	if (s_output != NULL) {
-		*f_output = fopen(s_output, "wb");
+		/* Readable too, so that it can be mapped by bmp_save() */
+		*f_output = fopen(s_output, "w+b");
 		if (!*f_output) {
 			fprintf(stderr, "Error: opening file '%s': %s\n",
 				s_output, strerror(errno));
@@ -113,21 +603,129 @@ static void io_close(FILE *f_input, FILE *f_output)
 		fclose(f_output);
 }
 
+static unsigned cpus(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (n > 0) ? n : 1;
+}
+
+static int run_batch(const args_t *args)
+{
+	batch_t batch = {
+		.f_list = stdin,
+		.delim = (args->nul_list) ? '\0' : '\n',
+		.jobs = args->jobs,
+		.conv = args->conv,
+	};
+	int ret;
+
+	if (batch.jobs == 0)
+		batch.jobs = cpus();
+
+	/* Files are already converted in parallel */
+	batch.conv.threads = 1;
+
+	if (args->s_list && strcmp(args->s_list, "-")) {
+		batch.f_list = fopen(args->s_list, "r");
+		if (!batch.f_list) {
+			fprintf(stderr, "Error: opening file '%s': %s\n",
+				args->s_list, strerror(errno));
+			return 1;
+		}
+	}
+
+	ret = batch_run(&batch);
+
+	if (batch.f_list != stdin)
+		fclose(batch.f_list);
+
+	return ret;
+}
+
+static int run_serve(const args_t *args)
+{
+	serve_t serve = {
+		.s_socket = args->s_socket,
+		.jobs = (args->jobs) ? args->jobs : cpus(),
+		.conv = args->conv,
+	};
+
+	/* Requests are already served in parallel */
+	serve.conv.threads = 1;
+
+	return serve_run(&serve);
+}
+
+static int run_info(const args_t *args)
+{
+	gif_info_t info;
+	FILE *f_input = stdin;
+	const uint8_t *gif;
+	size_t gif_size;
+	size_t ret;
+
+	if (args->s_input && (f_input = fopen(args->s_input, "rb")) == NULL) {
+		fprintf(stderr, "Error: opening file '%s': %s\n",
+			args->s_input, strerror(errno));
+		return 1;
+	}
+
+	if ((gif = io_map(f_input, &gif_size)) != NULL) {
+		ret = gif_probe_mem(&info, gif, gif_size);
+		ret = io_unmap(f_input, gif, gif_size) == 0 && ret;
+	}
+	else
+		ret = gif_probe(&info, f_input);
+
+	if (ret)
+		stats_print_info(stdout, args->s_input, &info);
+
+	if (f_input != stdin)
+		fclose(f_input);
+
+	return (ret) ? 0 : 1;
+}
+
 int main(int argc, char *argv[])
 {
-	char *s_input = NULL;
-	char *s_output = NULL;
+	args_t args = { .conv = { .format = IMG_BGR } };
+	image_t img = { .data = NULL} ;
+	stats_t stats = { .frames = 0 };
+	gif_ctx_t *ctx;
+	arena_t arena;
 	FILE *f_input = NULL;
 	FILE *f_output = NULL;
 	int ret;
 
-	if (args_parse(argc, argv, &s_input, &s_output))
+	if (args_parse(argc, argv, &args))
 		return 1;
+	io_guard();
 
-	if (io_open(s_input, s_output, &f_input, &f_output))
+	if (args.s_list || args.nul_list)
+		return run_batch(&args);
+	if (args.s_socket)
+		return run_serve(&args);
+	if (args.info)
+		return run_info(&args);
+	args.conv.threads = (args.jobs) ? args.jobs : cpus();
+
+	if (io_open(args.s_input, args.s_output, &f_input, &f_output))
+		return 1;
+
+	if ((ctx = gif_ctx_create(NULL)) == NULL) {
+		fprintf(stderr, "Not enough memory\n");
+		io_close(f_input, f_output);
 		return 1;
+	}
 
-	ret = gif2bmp(f_input, f_output);
+	arena_init(&arena, args.conv.huge);
+	ret = gif2bmp(f_input, f_output, args.s_output, &img, ctx, &arena,
+		&args.conv, (args.conv.stats) ? &stats : NULL);
+	if (args.conv.stats)
+		stats_print(stderr, args.s_input, args.s_output, &stats);
+	gif_ctx_destroy(ctx);
+	arena_destroy(&arena);
 	io_close(f_input, f_output);
 
 	return ret;
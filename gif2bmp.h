@@ -11,14 +11,40 @@
 #ifndef GIF2BMP_H
 #define GIF2BMP_H
 
+#include <stdio.h>
 #include <stdint.h>
 
+#include "image.h"
+
+/* Conversion options */
 typedef struct
 {
-	uint16_t width;
-	uint16_t height;
-	uint8_t *data;	/* RGB */
-} image_t;
+	img_format_t format;	/* Pixel format of decoded image */
+	int stream;		/* Stream rows into top-down BMP, no canvas */
+	int frames;		/* Write every frame of animation too */
+	int stats;		/* Print statistics of every image */
+	const char *s_preview;	/* Early preview of interlaced image */
+	unsigned threads;	/* Threads decoding images of animation and
+				   converting rows of one BMP */
+	int huge;		/* Hugepages for large canvas (arena) */
+	unsigned scale;		/* Downscale by this factor (0, 1 - none) */
+	unsigned max_dim;	/* Downscale so that the larger side is at
+				   most this (0 - none), if scale is 0 */
+	img_rect_t crop;	/* Convert this part only (width 0 - all) */
+	int pipeline;		/* Read input and write rows by threads of
+				   their own, while decoding (as stream) */
+} conv_opts_t;
+
+struct gif_ctx;
+struct arena;
+struct stats;
+
+/* Convert one GIF into BMP - ctx and arena may be reused between calls, the
+   canvas (img->data) is taken from arena. Frames of animation are written
+   next to s_output (if requested), stats (if not NULL) are added up */
+extern int gif2bmp(FILE *input, FILE *output, const char *s_output,
+	image_t *img, struct gif_ctx *ctx, struct arena *arena,
+	const conv_opts_t *opts, struct stats *stats);
 
 #endif // GIF2BMP_H
 
@@ -0,0 +1,54 @@
+/*
+ * image.h - Decoded image - pixel formats, image and rectangle
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Pixel format of image data */
+typedef enum
+{
+	IMG_RGB = 0,	/* 3 bytes per pixel */
+	IMG_INDEXED,	/* 1 byte per pixel - index into palette */
+	IMG_BGR,	/* 3 bytes per pixel in BMP order, rows padded to 4 bytes
+			   - written out by bmp_save() as they are */
+	IMG_BGRA,	/* 4 bytes per pixel in BMP order, alpha 0 where the
+			   background shows through - written out as 32bpp */
+} img_format_t;
+
+#define IMG_PIXEL_SIZE(format)	(((format) == IMG_INDEXED) ? 1u : \
+				((format) == IMG_BGRA) ? 4u : 3u)
+#define IMG_ROW_SIZE(format, w)	(((format) == IMG_BGR) ? \
+				((uint32_t) (w) * 3u + 3u) & ~3u : \
+				(uint32_t) (w) * IMG_PIXEL_SIZE(format))
+
+typedef struct
+{
+	uint16_t width;
+	uint16_t height;
+	img_format_t format;	/* Requested by caller before loading */
+	uint16_t colors;	/* Number of palette entries (IMG_INDEXED) */
+	uint8_t palette[256 * 3];	/* RGB palette (IMG_INDEXED) */
+	uint8_t *data;	/* Pixels (RGB, BGR, BGRA) or palette indices */
+	size_t data_size;	/* Allocated size of data - reused if it fits */
+} image_t;
+
+/* Rectangle within image */
+typedef struct
+{
+	uint16_t left;
+	uint16_t top;
+	uint16_t width;
+	uint16_t height;
+} img_rect_t;
+
+#endif // IMAGE_H
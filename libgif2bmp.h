@@ -0,0 +1,64 @@
+/*
+ * libgif2bmp.h - Public interface of libgif2bmp (GIF decoder, BMP writer)
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef LIBGIF2BMP_H
+#define LIBGIF2BMP_H
+
+/*
+ * Decoding:
+ *   gif_ctx_create()	- context with caller's allocator (mem_alloc_t),
+ *			  reusable for any number of images, one thread at a
+ *			  time
+ *   gif_ctx_set_opts()	- row sink (rows of the first image as they are
+ *			  decoded, no canvas), frame sink (every frame of
+ *			  animation composited), statistics, arena_t the
+ *			  canvas is taken from (reset for every image)
+ *   gif_load_mem()	- GIF held in memory
+ *   gif_load_cb()	- GIF read by gif_read_fn callback
+ *   gif_load_feed()	- GIF parsed while another thread reads it, waiting
+ *			  for its bytes by gif_wait_fn callback
+ *   gif_probe_mem(), gif_probe_cb()
+ *			- gif_info_t summary (size, frames, color tables,
+ *			  loops, delays) without decoding any image data
+ *
+ * Writing:
+ *   bmp_size()		- size of BMP of decoded image
+ *   bmp_save_mem()	- BMP into caller's buffer
+ *   bmp_save_cb()	- BMP by bmp_write_fn callback
+ *   bmp_stream_open_cb(), bmp_stream_row(), bmp_stream_close()
+ *			- top-down BMP written row by row, bmp_stream_row()
+ *			  is a row sink itself
+ *   scale_open(), scale_row(), scale_close()
+ *			- image downscaled while it is decoded, scale_row()
+ *			  is a row sink passing reduced rows to another one
+ *   crop_open(), crop_row(), crop_close()
+ *			- rectangle cut out while decoding, which stops right
+ *			  after its last row (GIF_ROW_DONE from row sink)
+ *   pipe_open(), pipe_load(), pipe_row(), pipe_close()
+ *			- input read ahead and rows written by threads of
+ *			  their own, pipe_row() is a row sink handing bands
+ *			  of rows to another one (in writer thread)
+ *   Row buffers of writers are taken from mem_alloc_t - arena->alloc draws
+ *   them from arena
+ *
+ * Errors are reported by return value (0 bytes), with a message on stderr.
+ */
+
+#include "image.h"
+#include "alloc.h"
+#include "arena.h"
+#include "stats.h"
+#include "gif.h"
+#include "bmp.h"
+#include "scale.h"
+#include "crop.h"
+#include "pipe.h"
+
+#endif // LIBGIF2BMP_H
@@ -0,0 +1,301 @@
+/*
+ * pipe.c - Read, decode and write one image by three overlapping threads
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pipe.h"
+
+#define PIPE_CHUNK	(1u << 18)	/* Bytes read at once, and the most
+					   decoder gets by one wait */
+#define PIPE_WINDOW	(4u * PIPE_CHUNK)	/* Bytes of input ring */
+#define PIPE_SLACK	1024u		/* Room past the ring end - more than
+					   the longest piece of input decoder
+					   takes at once (color table) */
+#define PIPE_BAND_SIZE	(1u << 18)	/* Bytes of rows per band */
+#define PIPE_BANDS	4u
+
+/* Read input ahead, chunk by chunk - decoder waits in pipe_wait() only if
+   it catches up with the reader, reader waits while the ring is full of
+   input decoder has not released yet */
+static void *pipe_reader(void *arg)
+{
+	pipe_t *p = (pipe_t *) arg;
+	size_t len = 0;
+	size_t cnt;
+	int closing;
+	stats_time_t mark;
+
+	for (;;) {
+		pthread_mutex_lock(&p->lock);
+		while (!p->closing && len - p->tail > PIPE_WINDOW - PIPE_CHUNK)
+			pthread_cond_wait(&p->cond_space, &p->lock);
+		closing = p->closing;
+		pthread_mutex_unlock(&p->lock);
+		if (closing)
+			break;
+
+		/* Chunks never cross the ring end - only the last one is
+		   short */
+		stats_start(&mark);
+		cnt = fread(p->buf + len % PIPE_WINDOW, 1, PIPE_CHUNK,
+			p->input);
+		stats_stop(&mark, &p->stats.read);
+		len += cnt;
+
+		pthread_mutex_lock(&p->lock);
+		p->head = len;
+		pthread_cond_broadcast(&p->cond_input);
+		pthread_mutex_unlock(&p->lock);
+		if (cnt < PIPE_CHUNK)
+			break;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->read_done = 1;
+	p->read_err = ferror(p->input) != 0;
+	pthread_cond_broadcast(&p->cond_input);
+	pthread_mutex_unlock(&p->lock);
+
+	if (p->read_err)
+		fprintf(stderr, "GIF: read error\n");
+
+	return NULL;
+}
+
+/* gif_wait_fn of the input ring - window ends at the ring end, unless len
+   bytes wrap around it, which are copied past the end then */
+static const uint8_t *pipe_wait(void *opaque, size_t used, size_t len,
+	size_t *avail)
+{
+	pipe_t *p = (pipe_t *) opaque;
+	size_t pos;
+	size_t cnt;
+
+	pthread_mutex_lock(&p->lock);
+	p->tail += used;
+	pthread_cond_broadcast(&p->cond_space);
+	while (p->head - p->tail < len && !p->read_done)
+		pthread_cond_wait(&p->cond_input, &p->lock);
+	cnt = p->head - p->tail;
+	pthread_mutex_unlock(&p->lock);
+
+	/* Tail is moved by this thread only */
+	pos = p->tail % PIPE_WINDOW;
+	if (cnt > PIPE_CHUNK)
+		cnt = PIPE_CHUNK;
+	if (pos + cnt > PIPE_WINDOW) {
+		if (PIPE_WINDOW - pos >= len)
+			cnt = PIPE_WINDOW - pos;
+		else {
+			if (cnt > len)
+				cnt = len;
+			if (pos + cnt > PIPE_WINDOW + PIPE_SLACK)
+				cnt = PIPE_WINDOW + PIPE_SLACK - pos;
+			memcpy(p->buf + PIPE_WINDOW, p->buf,
+				pos + cnt - PIPE_WINDOW);
+		}
+	}
+	*avail = cnt;
+
+	return p->buf + pos;
+}
+
+/* Hand rows of the ring over to sink as soon as decoder completes them */
+static void *pipe_writer(void *arg)
+{
+	pipe_t *p = (pipe_t *) arg;
+	uint32_t cap;
+	uint16_t ready;
+	uint16_t y;
+	int ret = 0;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (p->ready == p->rows_out && !p->closing)
+			pthread_cond_wait(&p->cond_ring, &p->lock);
+		if (p->ready == p->rows_out)
+			break;
+		ready = p->ready;
+		pthread_mutex_unlock(&p->lock);
+
+		/* Rows up to ready stay untouched by decoder */
+		cap = PIPE_BANDS * p->band_rows;
+		for (y = p->rows_out; y != ready && ret == 0; y++)
+			ret = p->sink(p->opaque, &p->img, y, p->ring
+				+ (size_t) (y % cap) * p->row_size);
+
+		pthread_mutex_lock(&p->lock);
+		p->rows_out = ready;
+		p->sink_ret = ret;
+		pthread_cond_broadcast(&p->cond_ring);
+		if (ret)
+			break;
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
+}
+
+int pipe_open(pipe_t *p, FILE *input, gif_row_fn sink, void *opaque,
+	const mem_alloc_t *alloc)
+{
+	memset(p, 0, sizeof(pipe_t));
+	p->input = input;
+	p->sink = sink;
+	p->opaque = opaque;
+	p->alloc = alloc;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond_input, NULL);
+	pthread_cond_init(&p->cond_space, NULL);
+	pthread_cond_init(&p->cond_ring, NULL);
+
+	if ((p->buf = (uint8_t *) mem_malloc(alloc, PIPE_WINDOW + PIPE_SLACK))
+		== NULL) {
+		fprintf(stderr, "Not enough memory\n");
+		pthread_cond_destroy(&p->cond_ring);
+		pthread_cond_destroy(&p->cond_space);
+		pthread_cond_destroy(&p->cond_input);
+		pthread_mutex_destroy(&p->lock);
+		return 1;
+	}
+
+	/* Input is read by decoder as usual if reader fails to start */
+	p->reading = pthread_create(&p->reader, NULL, pipe_reader, p) == 0;
+
+	/* Rows are written by decoder if writer fails to start */
+	p->writing = pthread_create(&p->writer, NULL, pipe_writer, p) == 0;
+
+	return 0;
+}
+
+size_t pipe_load(pipe_t *p, image_t *img, gif_ctx_t *ctx)
+{
+	if (p->reading)
+		return gif_load_feed(img, pipe_wait, p, ctx);
+
+	return gif_load(img, p->input, ctx);
+}
+
+/* Ring is set up by the first row - PIPE_BANDS bands of whole rows */
+static int pipe_init(pipe_t *p, const image_t *img)
+{
+	size_t size;
+
+	p->img = *img;
+	p->img.data = NULL;
+	p->img.data_size = 0;
+	p->row_size = img->width * IMG_PIXEL_SIZE(img->format);
+	p->band_rows = (p->row_size && PIPE_BAND_SIZE / p->row_size
+		< img->height) ? PIPE_BAND_SIZE / p->row_size : img->height;
+	if (p->band_rows == 0)
+		p->band_rows = 1;
+
+	size = (size_t) PIPE_BANDS * p->band_rows * p->row_size;
+	if ((p->ring = (uint8_t *) mem_malloc(p->alloc, (size) ? size : 1))
+		== NULL) {
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int pipe_row(void *opaque, const image_t *img, uint16_t y,
+	const uint8_t *row)
+{
+	pipe_t *p = (pipe_t *) opaque;
+	uint32_t cap;
+	int ret = 0;
+
+	/* No writer thread - rows go right to sink */
+	if (!p->writing)
+		return p->sink(p->opaque, img, y, row);
+
+	if (p->err || y != p->rows || (y == 0 && pipe_init(p, img))) {
+		p->err = 1;
+		return 1;
+	}
+	cap = PIPE_BANDS * p->band_rows;
+
+	/* Band starts - wait till writer makes room for the whole of it */
+	if (p->rows % p->band_rows == 0) {
+		pthread_mutex_lock(&p->lock);
+		while (p->sink_ret == 0
+			&& (uint32_t) (p->rows - p->rows_out)
+			> cap - p->band_rows)
+			pthread_cond_wait(&p->cond_ring, &p->lock);
+		ret = p->sink_ret;
+		pthread_mutex_unlock(&p->lock);
+		if (ret)
+			return ret;
+	}
+
+	memcpy(p->ring + (size_t) (p->rows % cap) * p->row_size, row,
+		p->row_size);
+	p->rows++;
+
+	/* Band is complete - hand it over */
+	if (p->rows % p->band_rows == 0) {
+		pthread_mutex_lock(&p->lock);
+		p->ready = p->rows;
+		pthread_cond_broadcast(&p->cond_ring);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	return 0;
+}
+
+int pipe_close(pipe_t *p, stats_t *stats)
+{
+	size_t held = PIPE_WINDOW + PIPE_SLACK + (size_t) PIPE_BANDS
+		* p->band_rows * p->row_size;
+	int ret;
+
+	/* Rows of the last band, then stop both threads */
+	pthread_mutex_lock(&p->lock);
+	p->ready = p->rows;
+	p->closing = 1;
+	pthread_cond_broadcast(&p->cond_ring);
+	pthread_cond_broadcast(&p->cond_space);
+	pthread_mutex_unlock(&p->lock);
+
+	if (p->writing)
+		pthread_join(p->writer, NULL);
+	if (p->reading)
+		pthread_join(p->reader, NULL);
+
+	if (stats) {
+		stats->read.wall += p->stats.read.wall;
+		stats->read.cpu += p->stats.read.cpu;
+		stats->bmp.wall += p->stats.bmp.wall;
+		stats->bmp.cpu += p->stats.bmp.cpu;
+		/* Input and ring are held together with decoder buffers */
+		held += p->stats.peak_alloc;
+		if (stats->peak_alloc < stats->alloc + held)
+			stats->peak_alloc = stats->alloc + held;
+	}
+
+	ret = p->err || (p->sink_ret && p->sink_ret != GIF_ROW_DONE)
+		|| p->read_err;
+
+	mem_free(p->alloc, p->ring);
+	mem_free(p->alloc, p->buf);
+	p->ring = NULL;
+	p->buf = NULL;
+	pthread_cond_destroy(&p->cond_ring);
+	pthread_cond_destroy(&p->cond_space);
+	pthread_cond_destroy(&p->cond_input);
+	pthread_mutex_destroy(&p->lock);
+
+	return ret;
+}
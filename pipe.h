@@ -0,0 +1,77 @@
+/*
+ * pipe.h - Read, decode and write one image by three overlapping threads
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef PIPE_H
+#define PIPE_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "image.h"
+#include "gif.h"
+#include "stats.h"
+#include "alloc.h"
+
+/* Pipeline - reader thread reads input ahead of the decoder (calling
+   thread), which hands finished rows over to writer thread in bands of
+   PIPE_BAND_SIZE bytes. Input is read into ring of PIPE_WINDOW bytes, which
+   decoder releases as it goes - reader blocks while the ring is full. Rows
+   wait in ring of PIPE_BANDS bands - decoder blocks while the ring is full,
+   so it never gets far ahead of writer */
+typedef struct
+{
+	/* Reader stage */
+	FILE *input;
+	uint8_t *buf;		/* Ring of input, with room past its end for
+				   bytes which wrap around it */
+	size_t head;		/* Bytes of input read so far */
+	size_t tail;		/* Bytes of input released by decoder */
+	int read_done;		/* Reader has finished (or failed) */
+	int read_err;
+	/* Writer stage */
+	gif_row_fn sink;	/* Gets rows (in img.format) in writer thread */
+	void *opaque;		/* Passed to sink */
+	image_t img;		/* Header of image - set by the first row */
+	uint8_t *ring;		/* PIPE_BANDS bands of band_rows rows */
+	uint32_t row_size;
+	uint16_t band_rows;
+	uint16_t rows;		/* Rows put into ring */
+	uint16_t ready;		/* Rows handed over to writer */
+	uint16_t rows_out;	/* Rows done by sink */
+	int sink_ret;		/* Non-zero once sink returns it */
+	int err;		/* Rows missing (or no memory for ring) */
+	int closing;		/* No more rows (nor input) wanted */
+	const mem_alloc_t *alloc;
+	stats_t stats;		/* Stages of reader and writer threads */
+	pthread_mutex_t lock;
+	pthread_cond_t cond_input;	/* More input read */
+	pthread_cond_t cond_space;	/* Input released by decoder */
+	pthread_cond_t cond_ring;	/* Rows handed over or written */
+	pthread_t reader;
+	pthread_t writer;
+	int reading;		/* Reader thread runs */
+	int writing;		/* Writer thread runs */
+} pipe_t;
+
+/* Start reader and writer thread. Buffers are taken from alloc and used by
+   other threads, so it must not be an arena */
+extern int pipe_open(pipe_t *p, FILE *input, gif_row_fn sink, void *opaque,
+	const mem_alloc_t *alloc);
+/* Decode input (as gif_load() does) - ctx has to have pipe_row() with p
+   as its row sink */
+extern size_t pipe_load(pipe_t *p, image_t *img, gif_ctx_t *ctx);
+/* Add next row - usable as gif_row_fn with p as opaque */
+extern int pipe_row(void *opaque, const image_t *img, uint16_t y,
+	const uint8_t *row);
+/* Write the rest of rows, stop threads and add their stages to stats (if not
+   NULL). Returns non-zero on error */
+extern int pipe_close(pipe_t *p, stats_t *stats);
+
+#endif // PIPE_H
@@ -0,0 +1,155 @@
+/*
+ * scale.c - Downscale image row by row as it is decoded
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "scale.h"
+
+void scale_open(scale_t *s, unsigned factor, unsigned max_dim,
+	gif_row_fn sink, void *opaque, const mem_alloc_t *alloc)
+{
+	memset(s, 0, sizeof(scale_t));
+	s->factor = factor;
+	s->max_dim = max_dim;
+	s->sink = sink;
+	s->opaque = opaque;
+	s->alloc = alloc;
+}
+
+/* Size of source is known once its first row comes - set up reduced image */
+static int scale_init(scale_t *s, const image_t *src)
+{
+	unsigned side = (src->width > src->height) ? src->width : src->height;
+	unsigned px = IMG_PIXEL_SIZE(src->format);
+	unsigned f = s->factor;
+	size_t size;
+
+	if (f == 0 && s->max_dim)
+		f = (side + s->max_dim - 1) / s->max_dim;
+	if (f == 0)
+		f = 1;
+	s->factor = f;
+
+	s->img.width = (src->width + f - 1) / f;
+	s->img.height = (src->height + f - 1) / f;
+	s->img.format = src->format;
+	s->img.colors = src->colors;
+	memcpy(s->img.palette, src->palette, sizeof(s->img.palette));
+
+	s->sums = (uint64_t *) mem_malloc(s->alloc, (size_t) s->img.width * px
+		* sizeof(uint64_t));
+	if (s->sums == NULL)
+		goto scale_err;
+	memset(s->sums, 0, (size_t) s->img.width * px * sizeof(uint64_t));
+
+	if (s->sink) {
+		if ((s->row = (uint8_t *) mem_malloc(s->alloc,
+			s->img.width * px)) == NULL)
+			goto scale_err;
+	}
+	else {
+		size = (size_t) s->img.height * IMG_ROW_SIZE(s->img.format,
+			s->img.width);
+		if ((s->img.data = (uint8_t *) mem_malloc(s->alloc, size))
+			== NULL)
+			goto scale_err;
+		s->img.data_size = size;
+	}
+
+	return 0;
+
+scale_err:
+	fprintf(stderr, "Not enough memory\n");
+
+	return 1;
+}
+
+/* Hand over reduced row held in dst */
+static int scale_emit(scale_t *s, uint8_t *dst)
+{
+	uint32_t len = s->img.width * IMG_PIXEL_SIZE(s->img.format);
+
+	if (s->sink) {
+		if (s->sink(s->opaque, &s->img, s->rows_out, dst))
+			return 1;
+	}
+	else {
+		/* BMP row padding is written out as it is */
+		memset(dst + len, 0, IMG_ROW_SIZE(s->img.format, s->img.width)
+			- len);
+	}
+	s->rows_out++;
+
+	return 0;
+}
+
+int scale_row(void *opaque, const image_t *img, uint16_t y,
+	const uint8_t *row)
+{
+	scale_t *s = (scale_t *) opaque;
+	unsigned px = IMG_PIXEL_SIZE(img->format);
+	unsigned f, c;
+	uint64_t *sums;
+	uint8_t *dst;
+	uint32_t x, o, end, cnt, rows;
+
+	if (s->err || y != s->rows || (y == 0 && scale_init(s, img))) {
+		s->err = 1;
+		return 1;
+	}
+	f = s->factor;
+	sums = s->sums;
+	dst = (s->sink) ? s->row : s->img.data + (size_t) s->rows_out
+		* IMG_ROW_SIZE(s->img.format, s->img.width);
+	s->rows++;
+
+	/* Averaged indices mean nothing - block gets its top left pixel */
+	if (img->format == IMG_INDEXED) {
+		if (y % f)
+			return 0;
+		for (x = 0; x < s->img.width; x++)
+			dst[x] = row[x * f];
+		return s->err = scale_emit(s, dst);
+	}
+
+	for (x = 0, o = 0; x < img->width; o += px) {
+		end = (x + f < img->width) ? x + f : img->width;
+		for (; x < end; x++) {
+			for (c = 0; c < px; c++)
+				sums[o + c] += row[x * px + c];
+		}
+	}
+
+	/* Block row is complete (the last one may be shorter) */
+	if (s->rows % f && s->rows != img->height)
+		return 0;
+
+	rows = (s->rows % f) ? s->rows % f : f;
+	for (x = 0, o = 0; x < s->img.width; x++, o += px) {
+		cnt = ((x + 1) * f <= img->width) ? f : img->width - x * f;
+		cnt *= rows;
+		for (c = 0; c < px; c++)
+			dst[o + c] = (sums[o + c] + cnt / 2) / cnt;
+	}
+	memset(sums, 0, (size_t) s->img.width * px * sizeof(uint64_t));
+
+	return s->err = scale_emit(s, dst);
+}
+
+int scale_close(scale_t *s)
+{
+	mem_free(s->alloc, s->row);
+	mem_free(s->alloc, s->sums);
+	s->row = NULL;
+	s->sums = NULL;
+
+	return s->err || s->rows_out != s->img.height;
+}
@@ -0,0 +1,49 @@
+/*
+ * scale.h - Downscale image row by row as it is decoded
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef SCALE_H
+#define SCALE_H
+
+#include "image.h"
+#include "gif.h"
+#include "alloc.h"
+
+/* Downscaling row sink - every factor x factor block of source pixels gives
+   one pixel: their average (box filter, of alpha too), or the top left one
+   if the image is indexed. Only one row of block sums is held, reduced rows
+   go to sink, or into img.data if there is no sink */
+typedef struct
+{
+	unsigned factor;	/* Source pixels per output pixel, each way */
+	unsigned max_dim;	/* If factor is 0, it is chosen so that the
+				   larger side is at most max_dim */
+	gif_row_fn sink;	/* Gets reduced rows (in img->format) */
+	void *opaque;		/* Passed to sink */
+	const mem_alloc_t *alloc;
+	image_t img;		/* Reduced image - set by the first row */
+	uint64_t *sums;		/* Sums of the current block row - up to
+				   factor * factor * 255 each */
+	uint8_t *row;		/* Reduced row handed to sink */
+	uint16_t rows;		/* Source rows added to sums */
+	uint16_t rows_out;	/* Reduced rows done */
+	int err;
+} scale_t;
+
+/* img.data (without sink) is taken from alloc and it has to be freed by it,
+   unless the allocator is an arena */
+extern void scale_open(scale_t *s, unsigned factor, unsigned max_dim,
+	gif_row_fn sink, void *opaque, const mem_alloc_t *alloc);
+/* Add next source row - usable as gif_row_fn with s as opaque */
+extern int scale_row(void *opaque, const image_t *img, uint16_t y,
+	const uint8_t *row);
+/* Returns non-zero on error or if any row is missing */
+extern int scale_close(scale_t *s);
+
+#endif // SCALE_H
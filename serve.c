@@ -0,0 +1,359 @@
+/*
+ * serve.c - Convert GIF images sent over Unix domain socket
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "serve.h"
+#include "gif.h"
+#include "bmp.h"
+#include "stats.h"
+
+/* Buffers every worker starts with, so usual requests allocate nothing */
+#define WARM_GIF	(1u << 20)
+#define WARM_BMP	(8u << 20)
+
+/* State shared by all workers */
+typedef struct
+{
+	const serve_t *serve;
+	int fd;			/* Listening socket */
+	pthread_mutex_t lock;	/* Guards stop and connections of workers */
+	int stop;
+} pool_t;
+
+/* Per-worker buffers - reused for every request the worker serves */
+typedef struct
+{
+	pool_t *pool;
+	pthread_t thread;
+	int fd;			/* Connection being served, -1 if none */
+	gif_ctx_t *ctx;
+	arena_t arena;		/* Canvas of current request */
+	image_t img;
+	uint8_t *gif;
+	size_t gif_size;
+	uint8_t *out;		/* Response header followed by BMP */
+	size_t out_size;
+} worker_t;
+
+static void put_u32(uint8_t *buf, uint32_t val)
+{
+	buf[0] = val;
+	buf[1] = val >> 8;
+	buf[2] = val >> 16;
+	buf[3] = val >> 24;
+}
+
+static uint32_t get_u32(const uint8_t *buf)
+{
+	return buf[0] | buf[1] << 8 | (uint32_t) buf[2] << 16
+		| (uint32_t) buf[3] << 24;
+}
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Returns 0 once all len bytes are read, 1 on error, end of stream or if
+   they have not come until deadline (of now_ms()) */
+static int read_full(int fd, void *buf, size_t len, int64_t deadline)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	int64_t left;
+	ssize_t cnt;
+
+	while (len > 0) {
+		if ((left = deadline - now_ms()) <= 0)
+			return 1;
+		cnt = poll(&pfd, 1, (left > INT32_MAX) ? INT32_MAX : left);
+		if (cnt < 0 && errno == EINTR)
+			continue;
+		if (cnt <= 0)
+			return 1;
+		cnt = recv(fd, buf, len, 0);
+		if (cnt < 0 && errno == EINTR)
+			continue;
+		if (cnt <= 0)
+			return 1;
+		buf = (uint8_t *) buf + cnt;
+		len -= cnt;
+	}
+
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	ssize_t cnt;
+
+	while (len > 0) {
+		cnt = send(fd, buf, len, MSG_NOSIGNAL);
+		if (cnt < 0 && errno == EINTR)
+			continue;
+		if (cnt <= 0)
+			return 1;
+		buf = (const uint8_t *) buf + cnt;
+		len -= cnt;
+	}
+
+	return 0;
+}
+
+static int respond_err(int fd, serve_status_t status)
+{
+	uint8_t resp[SERVE_RESP_SIZE];
+
+	put_u32(resp, status);
+	put_u32(resp + 4, 0);
+
+	return write_full(fd, resp, sizeof(resp));
+}
+
+/* Grow buffer to at least size bytes (contents are not kept) */
+static int reserve(uint8_t **buf, size_t *buf_size, size_t size)
+{
+	uint8_t *tmp;
+
+	if (*buf_size >= size)
+		return 0;
+
+	if ((tmp = (uint8_t *) realloc(*buf, size)) == NULL)
+		return 1;
+	*buf = tmp;
+	*buf_size = size;
+
+	return 0;
+}
+
+/* Serve one request, returns non-zero when connection has to be closed */
+static int serve_request(worker_t *w, int fd)
+{
+	const conv_opts_t *conv = &w->pool->serve->conv;
+	gif_opts_t gif_opts = { .row_sink = NULL, .frame_sink = NULL,
+		.arena = &w->arena };
+	stats_t stats = { .frames = 0 };
+	uint8_t header[SERVE_HEADER_SIZE];
+	int64_t deadline = now_ms() + SERVE_TIMEOUT * 1000;
+	uint32_t len;
+	size_t size;
+
+	/* Closed connection between requests is the regular end, idle one
+	   is closed so that it does not hold the worker */
+	if (read_full(fd, header, sizeof(header), deadline))
+		return 1;
+
+	if ((len = get_u32(header)) > SERVE_MAX_GIF) {
+		respond_err(fd, SERVE_ERR_TOO_BIG);
+		return 1;
+	}
+	if (reserve(&w->gif, &w->gif_size, len)) {
+		fprintf(stderr, "Not enough memory\n");
+		respond_err(fd, SERVE_ERR_MEMORY);
+		return 1;
+	}
+	if (read_full(fd, w->gif, len, deadline))
+		return 1;
+
+	if (conv->stats)
+		gif_opts.stats = &stats;
+	gif_ctx_set_opts(w->ctx, &gif_opts);
+
+	w->img.format = conv->format;
+	if (gif_load_mem(&w->img, w->gif, len, w->ctx) == 0
+		|| (size = bmp_size(&w->img)) == 0)
+		return respond_err(fd, SERVE_ERR_DECODE);
+
+	if (reserve(&w->out, &w->out_size, SERVE_RESP_SIZE + size)) {
+		fprintf(stderr, "Not enough memory\n");
+		return respond_err(fd, SERVE_ERR_MEMORY);
+	}
+	bmp_save_mem(&w->img, w->out + SERVE_RESP_SIZE, size, 1,
+		gif_opts.stats);
+	if (conv->stats)
+		stats_print(stderr, NULL, NULL, &stats);
+
+	put_u32(w->out, SERVE_OK);
+	put_u32(w->out + 4, size);
+
+	return write_full(fd, w->out, SERVE_RESP_SIZE + size);
+}
+
+static void *serve_worker(void *arg)
+{
+	worker_t *w = (worker_t *) arg;
+	pool_t *pool = w->pool;
+	struct timeval tv = { .tv_sec = SERVE_TIMEOUT };
+	int fd;
+
+	for (;;) {
+		if ((fd = accept(pool->fd, NULL, NULL)) < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;	/* Listening socket shut down */
+		}
+
+		/* Connection is shut down by serve_run() on exit */
+		pthread_mutex_lock(&pool->lock);
+		if (pool->stop) {
+			pthread_mutex_unlock(&pool->lock);
+			close(fd);
+			break;
+		}
+		w->fd = fd;
+		pthread_mutex_unlock(&pool->lock);
+
+		/* Client which does not read response is dropped too */
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		while (serve_request(w, fd) == 0)
+			;
+
+		pthread_mutex_lock(&pool->lock);
+		w->fd = -1;
+		pthread_mutex_unlock(&pool->lock);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/* Socket bound to path, listening */
+static int serve_listen(const char *s_socket, unsigned backlog)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (strlen(s_socket) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Serve: socket path too long\n");
+		return -1;
+	}
+	strcpy(addr.sun_path, s_socket);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		fprintf(stderr, "Serve: socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/* Socket left behind by previous server */
+	unlink(s_socket);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr))
+		|| listen(fd, backlog)) {
+		fprintf(stderr, "Serve: '%s': %s\n", s_socket,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Allocate everything worker needs up front */
+static int worker_warm(worker_t *w, int huge)
+{
+	w->fd = -1;
+	arena_init(&w->arena, huge);
+	if ((w->ctx = gif_ctx_create(NULL)) == NULL
+		|| reserve(&w->gif, &w->gif_size, WARM_GIF)
+		|| reserve(&w->out, &w->out_size, WARM_BMP)
+		|| arena_reset(&w->arena, WARM_BMP))
+		return 1;
+
+	return 0;
+}
+
+int serve_run(const serve_t *serve)
+{
+	pool_t pool = { .serve = serve, .stop = 0 };
+	worker_t *workers;
+	unsigned started = 0;
+	sigset_t sigs;
+	int sig;
+
+	if ((workers = (worker_t *) calloc(serve->jobs, sizeof(worker_t)))
+		== NULL) {
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+	if ((pool.fd = serve_listen(serve->s_socket, serve->jobs * 4)) < 0) {
+		free(workers);
+		return 1;
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+
+	/* Signals are taken by sigwait() below - workers inherit the mask */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	for (unsigned i = 0; i < serve->jobs; i++) {
+		workers[i].pool = &pool;
+		if (worker_warm(&workers[i], serve->conv.huge)) {
+			fprintf(stderr, "Not enough memory\n");
+			break;
+		}
+		if (pthread_create(&workers[i].thread, NULL, serve_worker,
+			&workers[i])) {
+			fprintf(stderr, "Serve: cannot start worker\n");
+			break;
+		}
+		started++;
+	}
+
+	if (started) {
+		fprintf(stderr, "Serve: listening on '%s' with %u workers\n",
+			serve->s_socket, started);
+		sigwait(&sigs, &sig);
+	}
+
+	/* Wake up workers - in accept() and in the middle of connection */
+	pthread_mutex_lock(&pool.lock);
+	pool.stop = 1;
+	shutdown(pool.fd, SHUT_RDWR);
+	for (unsigned i = 0; i < started; i++) {
+		if (workers[i].fd >= 0)
+			shutdown(workers[i].fd, SHUT_RDWR);
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	for (unsigned i = 0; i < serve->jobs; i++) {
+		if (i < started)
+			pthread_join(workers[i].thread, NULL);
+		gif_ctx_destroy(workers[i].ctx);
+		arena_destroy(&workers[i].arena);
+		free(workers[i].gif);
+		free(workers[i].out);
+	}
+
+	close(pool.fd);
+	unlink(serve->s_socket);
+	pthread_mutex_destroy(&pool.lock);
+	free(workers);
+
+	return (started) ? 0 : 1;
+}
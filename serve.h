@@ -0,0 +1,54 @@
+/*
+ * serve.h - Convert GIF images sent over Unix domain socket
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+
+#include "gif2bmp.h"
+
+/*
+ * Protocol - connection carries any number of requests, one after another.
+ * Request:	uint32 length, GIF of length bytes
+ * Response:	uint32 status, uint32 length, BMP of length bytes
+ *		(length is 0 unless status is SERVE_OK)
+ * All integers are little endian. Client closes connection when done, server
+ * closes it after SERVE_ERR_TOO_BIG (the rest of request is not read), and
+ * if the whole request does not come within SERVE_TIMEOUT seconds since the
+ * previous response (or since connecting), or response is not taken within
+ * that time - idle connections do not hold workers.
+ */
+#define SERVE_HEADER_SIZE	4u	/* Request header */
+#define SERVE_RESP_SIZE		8u	/* Response header */
+#define SERVE_MAX_GIF		(64u << 20)
+#define SERVE_TIMEOUT		10
+
+typedef enum
+{
+	SERVE_OK = 0,
+	SERVE_ERR_DECODE,	/* Invalid GIF, or BMP would be too big */
+	SERVE_ERR_TOO_BIG,	/* GIF longer than SERVE_MAX_GIF */
+	SERVE_ERR_MEMORY,
+} serve_status_t;
+
+/* Server configuration */
+typedef struct
+{
+	const char *s_socket;	/* Path of socket - replaced if it exists */
+	unsigned jobs;		/* Number of workers = connections served at
+				   once, the others wait in backlog */
+	conv_opts_t conv;	/* Options of every conversion */
+} serve_t;
+
+/* Serve until SIGINT or SIGTERM, returns 0 if server was set up */
+extern int serve_run(const serve_t *serve);
+
+#endif // SERVE_H
@@ -0,0 +1,115 @@
+/*
+ * stats.c - Timings and counters of one conversion
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+#include "gif.h"
+
+static double clock_sec(clockid_t clock)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts))
+		return 0;
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void stats_start(stats_time_t *mark)
+{
+	mark->wall = clock_sec(CLOCK_MONOTONIC);
+	mark->cpu = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void stats_stop(const stats_time_t *mark, stats_time_t *stage)
+{
+	stage->wall += clock_sec(CLOCK_MONOTONIC) - mark->wall;
+	stage->cpu += clock_sec(CLOCK_THREAD_CPUTIME_ID) - mark->cpu;
+}
+
+/* Write string as JSON string literal, NULL as null */
+static void print_string(FILE *f, const char *s)
+{
+	if (s == NULL) {
+		fputs("null", f);
+		return;
+	}
+
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char) *s < 0x20)
+			fprintf(f, "\\u%04x", (unsigned char) *s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static void print_time(FILE *f, const char *name, const stats_time_t *t)
+{
+	fprintf(f, "\"%s\":{\"wall\":%.6f,\"cpu\":%.6f},", name, t->wall,
+		t->cpu);
+}
+
+void stats_print(FILE *f, const char *s_input, const char *s_output,
+	const stats_t *stats)
+{
+	double avg = (stats->strings) ?
+		(double) stats->pixels / stats->strings : 0;
+
+	/* Lines of concurrent batch workers must not interleave */
+	flockfile(f);
+
+	fputs("{\"input\":", f);
+	print_string(f, s_input);
+	fputs(",\"output\":", f);
+	print_string(f, s_output);
+	fputc(',', f);
+	print_time(f, "read", &stats->read);
+	print_time(f, "header", &stats->header);
+	print_time(f, "ext", &stats->ext);
+	print_time(f, "lzw", &stats->lzw);
+	print_time(f, "bmp", &stats->bmp);
+	fprintf(f, "\"bytes_read\":%llu,\"sub_blocks\":%llu,\"codes\":%llu,"
+		"\"clear_codes\":%llu,\"dict_full\":%llu,\"pixels\":%llu,"
+		"\"avg_string_len\":%.3f,\"frames\":%u,\"peak_alloc\":%zu}\n",
+		(unsigned long long) stats->bytes_read,
+		(unsigned long long) stats->sub_blocks,
+		(unsigned long long) stats->codes,
+		(unsigned long long) stats->clear_codes,
+		(unsigned long long) stats->dict_full,
+		(unsigned long long) stats->pixels, avg, stats->frames,
+		stats->peak_alloc);
+
+	funlockfile(f);
+}
+
+void stats_print_info(FILE *f, const char *s_input, const gif_info_t *info)
+{
+	flockfile(f);
+
+	fputs("{\"input\":", f);
+	print_string(f, s_input);
+	fprintf(f, ",\"width\":%u,\"height\":%u,\"frames\":%u,"
+		"\"gct_colors\":%u,\"lct_colors\":%u,\"lct_frames\":%u,"
+		"\"interlaced\":%u,\"transparent\":%u,\"loops\":%d,"
+		"\"delay_cs\":%llu}\n", info->width, info->height,
+		info->frames, info->gct_colors, info->lct_colors,
+		info->lct_frames, info->interlaced, info->transparent,
+		info->loops, (unsigned long long) info->delay);
+
+	funlockfile(f);
+}
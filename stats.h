@@ -0,0 +1,59 @@
+/*
+ * stats.h - Timings and counters of one conversion
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Time spent in one stage, in seconds */
+typedef struct
+{
+	double wall;
+	double cpu;		/* CPU time of the calling thread */
+} stats_time_t;
+
+/* Statistics filled in by gif_load()/bmp_save() - all values are added up,
+   so the structure has to be zeroed by caller */
+typedef struct stats
+{
+	stats_time_t read;	/* Reading of input stream (not mapped files) */
+	stats_time_t header;	/* Header, descriptors and color tables */
+	stats_time_t ext;	/* Extensions */
+	stats_time_t lzw;	/* LZW decoding and compositing */
+	stats_time_t bmp;	/* BMP writing */
+	uint64_t bytes_read;	/* Bytes of GIF stream parsed */
+	uint64_t sub_blocks;	/* Image data sub-blocks */
+	uint64_t codes;		/* All LZW codes read */
+	uint64_t clear_codes;
+	uint64_t strings;	/* Codes which emitted a string */
+	uint64_t dict_full;	/* Codes read while dictionary was full */
+	uint64_t pixels;	/* Pixels emitted by LZW */
+	unsigned frames;	/* Images decoded */
+	size_t alloc;		/* Bytes of buffers decoder keeps after return */
+	size_t peak_alloc;	/* Bytes of buffers held at once */
+} stats_t;
+
+/* Stage timer - start it, then add the time elapsed since into a stage */
+extern void stats_start(stats_time_t *mark);
+extern void stats_stop(const stats_time_t *mark, stats_time_t *stage);
+
+struct gif_info;
+
+/* Write statistics as one JSON line */
+extern void stats_print(FILE *f, const char *s_input, const char *s_output,
+	const stats_t *stats);
+/* Write summary of probed GIF (gif_probe()) as one JSON line */
+extern void stats_print_info(FILE *f, const char *s_input,
+	const struct gif_info *info);
+
+#endif // STATS_H
@@ -0,0 +1,103 @@
+/*
+ * swizzle.c - Reorder RGB pixels into BGR (as stored in BMP)
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include "swizzle.h"
+
+#ifdef SWIZZLE_X86
+#include <immintrin.h>
+#endif
+
+void swizzle_scalar(uint8_t *dst, const uint8_t *src, uint32_t pixels)
+{
+	const uint8_t *end = src + pixels * 3u;
+
+	for (; src < end; src += 3, dst += 3) {
+		dst[0] = src[2];	/* Blue */
+		dst[1] = src[1];	/* Green */
+		dst[2] = src[0];	/* Red */
+	}
+}
+
+#ifdef SWIZZLE_X86
+
+/* Reverse bytes of each of the 4 pixels in low 12 bytes of a lane, the
+   upper 4 bytes are overwritten by the next store anyway */
+#define SWIZZLE_MASK	2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15
+
+/* 16 pixels per iteration - 4 pixels per 16 byte load/store, stores overlap.
+   Loads and stores reach 4 bytes past the 16 pixels, hence the margin */
+__attribute__((target("ssse3")))
+void swizzle_ssse3(uint8_t *dst, const uint8_t *src, uint32_t pixels)
+{
+	const __m128i mask = _mm_setr_epi8(SWIZZLE_MASK);
+	uint32_t i = 0;
+
+	for (; pixels - i >= 18; i += 16, src += 48, dst += 48) {
+		__m128i a = _mm_loadu_si128((const __m128i *) (src + 0));
+		__m128i b = _mm_loadu_si128((const __m128i *) (src + 12));
+		__m128i c = _mm_loadu_si128((const __m128i *) (src + 24));
+		__m128i d = _mm_loadu_si128((const __m128i *) (src + 36));
+
+		_mm_storeu_si128((__m128i *) (dst + 0), _mm_shuffle_epi8(a, mask));
+		_mm_storeu_si128((__m128i *) (dst + 12), _mm_shuffle_epi8(b, mask));
+		_mm_storeu_si128((__m128i *) (dst + 24), _mm_shuffle_epi8(c, mask));
+		_mm_storeu_si128((__m128i *) (dst + 36), _mm_shuffle_epi8(d, mask));
+	}
+
+	swizzle_scalar(dst, src, pixels - i);
+}
+
+/* 32 pixels per iteration. pshufb works within 128-bit lanes, so each lane
+   holds 4 pixels and the resulting 2 x 12 bytes are joined by a permute */
+__attribute__((target("avx2")))
+static inline __m256i swizzle8_avx2(const uint8_t *src, __m256i mask,
+	__m256i join)
+{
+	__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+		_mm_loadu_si128((const __m128i *) src)),
+		_mm_loadu_si128((const __m128i *) (src + 12)), 1);
+
+	return _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, mask), join);
+}
+
+__attribute__((target("avx2")))
+void swizzle_avx2(uint8_t *dst, const uint8_t *src, uint32_t pixels)
+{
+	const __m256i mask = _mm256_setr_epi8(SWIZZLE_MASK, SWIZZLE_MASK);
+	const __m256i join = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+	uint32_t i = 0;
+
+	for (; pixels - i >= 35; i += 32, src += 96, dst += 96) {
+		__m256i a = swizzle8_avx2(src + 0, mask, join);
+		__m256i b = swizzle8_avx2(src + 24, mask, join);
+		__m256i c = swizzle8_avx2(src + 48, mask, join);
+		__m256i d = swizzle8_avx2(src + 72, mask, join);
+
+		_mm256_storeu_si256((__m256i *) (dst + 0), a);
+		_mm256_storeu_si256((__m256i *) (dst + 24), b);
+		_mm256_storeu_si256((__m256i *) (dst + 48), c);
+		_mm256_storeu_si256((__m256i *) (dst + 72), d);
+	}
+
+	swizzle_ssse3(dst, src, pixels - i);
+}
+
+#endif // SWIZZLE_X86
+
+swizzle_fn swizzle_select(void)
+{
+#ifdef SWIZZLE_X86
+	if (__builtin_cpu_supports("avx2"))
+		return swizzle_avx2;
+	if (__builtin_cpu_supports("ssse3"))
+		return swizzle_ssse3;
+#endif
+	return swizzle_scalar;
+}
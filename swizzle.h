@@ -0,0 +1,29 @@
+/*
+ * swizzle.h - Reorder RGB pixels into BGR (as stored in BMP)
+ *
+ * Copyright (C) 2017 Jan Havran
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef SWIZZLE_H
+#define SWIZZLE_H
+
+#include <stdint.h>
+
+/* Convert 'pixels' RGB pixels of src into BGR dst (buffers must not overlap) */
+typedef void (*swizzle_fn)(uint8_t *dst, const uint8_t *src, uint32_t pixels);
+
+extern void swizzle_scalar(uint8_t *dst, const uint8_t *src, uint32_t pixels);
+#if defined(__x86_64__) || defined(__i386__)
+#define SWIZZLE_X86
+extern void swizzle_ssse3(uint8_t *dst, const uint8_t *src, uint32_t pixels);
+extern void swizzle_avx2(uint8_t *dst, const uint8_t *src, uint32_t pixels);
+#endif
+
+/* Fastest kernel supported by running CPU */
+extern swizzle_fn swizzle_select(void);
+
+#endif // SWIZZLE_H